@@ -0,0 +1,171 @@
+// ============================================
+// TABLE SIZE BENCHMARK
+// Times the layout-generic engine on tables from the classic 7-row deck up
+// to 28 rows over 16 decks. Positions come from random play; each
+// operation is then timed over all of them. "rescan" is the old way of
+// finding blocked cards, checking every pyramid slot, for comparison.
+//   g++ -O2 -std=c++17 pyramid_bench.cpp -o pyramid_bench
+// ============================================
+
+#include "pyramid_table.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <string>
+
+using namespace std;
+
+const int MAX_BENCH_MOVES = 4096;
+
+struct BenchOptions
+{
+    int games;
+    unsigned int seed;
+};
+
+template<class Layout>
+struct Sample
+{
+    int deal;
+    TableState<Layout> state;
+};
+
+double nanosecondsSince(chrono::steady_clock::time_point started, long long count) {
+    double ns = (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count();
+    return count > 0 ? ns / count : 0.0;
+}
+
+// Finds blocked cards by looking at every slot and both cards on it
+template<class Layout>
+int rescanFree(const TableState<Layout>& st) {
+    typedef TableEngine<ClassicRules, Layout> Engine;
+    int free = 0;
+    for (int row = 0; row < Layout::ROW_COUNT; row++) {
+        for (int col = 0; col <= row; col++) {
+            int slot = pyramidSlot(row, col);
+            if (Engine::isRemoved(st, slot))
+                continue;
+            if (row == Layout::ROW_COUNT - 1
+                || (Engine::isRemoved(st, pyramidSlot(row + 1, col)) && Engine::isRemoved(st, pyramidSlot(row + 1, col + 1))))
+                free++;
+        }
+    }
+    return free;
+}
+
+template<class Layout>
+void benchLayout(const BenchOptions& options) {
+    typedef TableEngine<ClassicRules, Layout> Engine;
+
+    vector<TableDeal<Layout>> deals(options.games);
+    vector<Sample<Layout>> samples;
+    vector<TableMove> moves(MAX_BENCH_MOVES);
+    unsigned int rng = options.seed;
+
+    // Random games, keeping every position along the way
+    for (int g = 0; g < options.games; g++) {
+        shuffleTable(deals[g], options.seed + (unsigned int)g);
+        Sample<Layout> sample;
+        sample.deal = g;
+        Engine::reset(deals[g], sample.state);
+
+        for (int step = 0; step < 20 * Layout::CARDS; step++) {
+            Engine::checkLose(deals[g], sample.state);
+            if (sample.state.won || sample.state.lost)
+                break;
+            samples.push_back(sample);
+
+            int count = Engine::listMoves(deals[g], sample.state, &moves[0], MAX_BENCH_MOVES);
+            if (count == 0)
+                break;
+            Engine::playMove(deals[g], sample.state, moves[nextRandom(rng) % count]);
+        }
+    }
+
+    long long checksum = 0;
+    long long count = (long long)samples.size();
+
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    for (size_t i = 0; i < samples.size(); i++) {
+        checksum += Engine::listMoves(deals[samples[i].deal], samples[i].state, &moves[0], MAX_BENCH_MOVES);
+    }
+    double listNs = nanosecondsSince(started, count);
+
+    started = chrono::steady_clock::now();
+    for (size_t i = 0; i < samples.size(); i++) {
+        TableState<Layout> copy = samples[i].state;
+        Engine::checkLose(deals[samples[i].deal], copy);
+        checksum += copy.lost;
+    }
+    double loseNs = nanosecondsSince(started, count);
+
+    // Removal cost includes the free-card update it triggers
+    vector<int> removable;
+    vector<TableMove> removals;
+    for (size_t i = 0; i < samples.size(); i++) {
+        int made = Engine::listMoves(deals[samples[i].deal], samples[i].state, &moves[0], 1);
+        if (made > 0 && moves[0].slot1 != NO_SLOT) {
+            removable.push_back((int)i);
+            removals.push_back(moves[0]);
+        }
+    }
+
+    started = chrono::steady_clock::now();
+    for (size_t r = 0; r < removable.size(); r++) {
+        const Sample<Layout>& sample = samples[removable[r]];
+        TableState<Layout> copy = sample.state;
+        Engine::playMove(deals[sample.deal], copy, removals[r]);
+        checksum += copy.pyramidLeft;
+    }
+    double removeNs = nanosecondsSince(started, (long long)removable.size());
+
+    started = chrono::steady_clock::now();
+    for (size_t i = 0; i < samples.size(); i++) {
+        TableState<Layout> copy = samples[i].state;
+        Engine::drawFromStock(copy);
+        checksum += copy.stockCursor;
+    }
+    double drawNs = nanosecondsSince(started, count);
+
+    started = chrono::steady_clock::now();
+    for (size_t i = 0; i < samples.size(); i++) {
+        checksum += rescanFree(samples[i].state);
+    }
+    double rescanNs = nanosecondsSince(started, count);
+
+    cout << setw(4) << Layout::ROW_COUNT << setw(6) << Layout::DECK_COUNT << setw(7) << Layout::CARDS
+         << setw(10) << count
+         << setw(10) << removeNs << setw(10) << listNs << setw(10) << loseNs
+         << setw(10) << drawNs << setw(10) << rescanNs
+         << "   (" << (checksum & 0xFF) << ")" << endl;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    options.games = 200;
+    options.seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--games" && i + 1 < argc)
+            options.games = atoi(argv[++i]);
+        else if (arg == "--seed" && i + 1 < argc)
+            options.seed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else {
+            cerr << "usage: pyramid_bench [--games N] [--seed N]" << endl;
+            return 1;
+        }
+    }
+    if (options.games < 1)
+        options.games = 1;
+
+    cout << fixed << setprecision(1);
+    cout << "rows decks  cards positions   remove     moves      lose      draw    rescan  (ns per call)" << endl;
+    benchLayout<ClassicLayout>(options);
+    benchLayout<PyramidLayout<10, 2>>(options);
+    benchLayout<BigTableLayout>(options);
+    benchLayout<PyramidLayout<20, 8>>(options);
+    benchLayout<PyramidLayout<28, 16>>(options);
+    return 0;
+}
@@ -0,0 +1,253 @@
+// ============================================
+// CONSISTENCY CHECKS
+// Cross-checks shortcuts in the engine and solver against a plain, slower
+// version of the same thing, over seeded deals and every rule set. Prints
+// each disagreement and exits non-zero if there was any.
+//   g++ -O2 -std=c++17 pyramid_check.cpp -o pyramid_check
+//   ./pyramid_check --deals 200
+// ============================================
+
+#include "pyramid_solver.h"
+#include "pyramid_table.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+struct CheckOptions
+{
+    unsigned int firstSeed;
+    int dealCount;
+    long long nodeLimit;
+};
+
+// Taking a free single at once must never turn a win into a loss: solve
+// each deal with and without the shortcut and compare where both finish
+template<class Rules>
+int checkSinglePruning(const CheckOptions& options, const char* name) {
+    int failures = 0;
+    int compared = 0;
+
+    for (int i = 0; i < options.dealCount; i++) {
+        unsigned int seed = options.firstSeed + (unsigned int)i;
+        Deal deal;
+        shuffleDeal(deal, seed);
+        GameState start;
+        resetState(start);
+
+        Solver<Rules> pruned(deal, nullptr);
+        pruned.nodeLimit = options.nodeLimit;
+        SolveResult fast = pruned.solve(start);
+
+        Solver<Rules> full(deal, nullptr);
+        full.nodeLimit = options.nodeLimit;
+        full.pruneSingles = false;
+        SolveResult slow = full.solve(start);
+
+        if (fast == SOLVE_UNKNOWN || slow == SOLVE_UNKNOWN)
+            continue;
+        compared++;
+
+        if (fast != slow) {
+            cout << "FAIL " << name << " single pruning: deal " << seed
+                 << " is a " << (slow == SOLVE_WIN ? "win" : "loss")
+                 << " but pruned search says " << (fast == SOLVE_WIN ? "win" : "loss") << endl;
+            failures++;
+        }
+    }
+
+    cout << name << " single pruning: " << compared << " deals compared, "
+         << failures << " disagreements" << endl;
+    return failures;
+}
+
+typedef vector<pair<int, int> > MoveList;
+
+// Whole moves read off the compact engine one free card at a time, in the
+// same form listMoves() gives them: a pair lowest slot first, NO_SLOT for a
+// single's partner, and NO_SLOT twice for a draw
+template<class Rules>
+MoveList compactMoves(const Deal& deal, const GameState& st) {
+    typedef PyramidEngine<Rules> Engine;
+    MoveList moves;
+    vector<int> free;
+    for (int slot = 0; slot < DECK_SIZE; slot++) {
+        if (Engine::isSlotFree(st, slot))
+            free.push_back(slot);
+    }
+
+    for (size_t i = 0; i < free.size(); i++) {
+        int value = cardValue(deal.cards[free[i]]);
+        if (Engine::isSingle(value)) {
+            moves.push_back(make_pair(free[i], NO_SLOT));
+            continue;
+        }
+        for (size_t j = i + 1; j < free.size(); j++) {
+            if (Engine::isPair(value, cardValue(deal.cards[free[j]])))
+                moves.push_back(make_pair(free[i], free[j]));
+        }
+    }
+
+    if (Engine::stockHasCards(st))
+        moves.push_back(make_pair(NO_SLOT, NO_SLOT));
+    sort(moves.begin(), moves.end());
+    return moves;
+}
+
+template<class Rules>
+MoveList tableMoves(const TableDeal<ClassicLayout>& deal, const TableState<ClassicLayout>& st) {
+    TableMove moves[MAX_CHILDREN * 4];
+    int count = TableEngine<Rules, ClassicLayout>::listMoves(deal, st, moves, MAX_CHILDREN * 4);
+    MoveList list;
+    for (int i = 0; i < count; i++) {
+        int a = moves[i].slot1;
+        int b = moves[i].slot2;
+        if (b != NO_SLOT && b < a)
+            swap(a, b);
+        list.push_back(make_pair(a, b));
+    }
+    sort(list.begin(), list.end());
+    return list;
+}
+
+// Where the two engines' views of one position differ, or empty
+template<class Rules>
+string compareStates(const Deal& deal, const GameState& st,
+                     const TableDeal<ClassicLayout>& tdeal, const TableState<ClassicLayout>& tst) {
+    typedef PyramidEngine<Rules> Engine;
+    typedef TableEngine<Rules, ClassicLayout> Table;
+
+    if (st.removed != tst.removed[0])
+        return "removed cards";
+    if (st.score != tst.score || st.moves != tst.moves)
+        return "score or move count";
+    if (st.stockCursor != tst.stockCursor || st.passes != tst.passes)
+        return "stock position";
+    if (st.selected != tst.selected)
+        return "selection";
+    if (st.won != tst.won || st.lost != tst.lost)
+        return "game over";
+    if (wasteTop(st) != Table::wasteTop(tst) || wasteSecond(st) != Table::wasteSecond(tst))
+        return "waste";
+    if (Engine::stockHasCards(st) != Table::stockHasCards(tst))
+        return "stock left";
+    for (int slot = 0; slot < DECK_SIZE; slot++) {
+        if (Engine::isSlotFree(st, slot) != Table::isSlotFree(tst, slot))
+            return "free card " + to_string(slot);
+    }
+    if (compactMoves<Rules>(deal, st) != tableMoves<Rules>(tdeal, tst))
+        return "move list";
+    return "";
+}
+
+// TableEngine on the classic layout must play exactly the compact game:
+// random playouts of clicks and draws, both engines stepped side by side
+template<class Rules>
+int checkTableEngine(const CheckOptions& options, const char* name) {
+    typedef PyramidEngine<Rules> Engine;
+    typedef TableEngine<Rules, ClassicLayout> Table;
+    int failures = 0;
+    long long steps = 0;
+
+    for (int i = 0; i < options.dealCount; i++) {
+        unsigned int seed = options.firstSeed + (unsigned int)i;
+        Deal deal;
+        shuffleDeal(deal, seed);
+        TableDeal<ClassicLayout> tdeal;
+        for (int slot = 0; slot < DECK_SIZE; slot++) {
+            tdeal.cards[slot] = deal.cards[slot];
+        }
+
+        GameState st;
+        resetState(st);
+        TableState<ClassicLayout> tst;
+        Table::reset(tdeal, tst);
+
+        unsigned int rng = seed * 2654435761u + 1;
+        for (int step = 0; step < 1000 && !st.won && !st.lost; step++) {
+            string difference = compareStates<Rules>(deal, st, tdeal, tst);
+            if (!difference.empty()) {
+                cout << "FAIL " << name << " table engine: deal " << seed << " step " << step
+                     << " differs in " << difference << endl;
+                failures++;
+                break;
+            }
+
+            // Mostly whole moves, sometimes a click on any card or a
+            // draw, so selections and misses are covered too
+            unsigned int roll = nextRandom(rng) % 8;
+            if (roll == 0) {
+                int slot = (int)(nextRandom(rng) % DECK_SIZE);
+                Engine::selectSlot(deal, st, slot);
+                Table::selectSlot(tdeal, tst, slot);
+            } else if (roll == 1) {
+                Engine::drawFromStock(st);
+                Table::drawFromStock(tst);
+            } else {
+                MoveList moves = compactMoves<Rules>(deal, st);
+                if (moves.empty())
+                    break;
+                pair<int, int> move = moves[nextRandom(rng) % moves.size()];
+                if (move.first == NO_SLOT) {
+                    Engine::drawFromStock(st);
+                } else {
+                    st.selected = NO_SLOT;
+                    Engine::selectSlot(deal, st, move.first);
+                    if (move.second != NO_SLOT)
+                        Engine::selectSlot(deal, st, move.second);
+                }
+                TableMove tmove;
+                tmove.slot1 = (short)move.first;
+                tmove.slot2 = (short)move.second;
+                Table::playMove(tdeal, tst, tmove);
+            }
+
+            Engine::checkLose(deal, st);
+            Table::checkLose(tdeal, tst);
+            steps++;
+        }
+    }
+
+    cout << name << " table engine: " << options.dealCount << " playouts, " << steps
+         << " steps compared, " << failures << " disagreements" << endl;
+    return failures;
+}
+
+template<class Rules>
+int runChecks(const CheckOptions& options, const char* name) {
+    int failures = checkTableEngine<Rules>(options, name);
+    failures += checkSinglePruning<Rules>(options, name);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    CheckOptions options;
+    options.firstSeed = 1;
+    options.dealCount = 200;
+    options.nodeLimit = 600000;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--first" && i + 1 < argc)
+            options.firstSeed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--deals" && i + 1 < argc)
+            options.dealCount = atoi(argv[++i]);
+        else if (arg == "--node-limit" && i + 1 < argc)
+            options.nodeLimit = atoll(argv[++i]);
+        else {
+            cerr << "usage: pyramid_check [--first SEED] [--deals N] [--node-limit N]" << endl;
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    failures += runChecks<ClassicRules>(options, "classic");
+    failures += runChecks<DrawThreeRules>(options, "draw3");
+    failures += runChecks<SinglePassRules>(options, "single-pass");
+
+    cout << (failures == 0 ? "all checks passed" : "checks FAILED") << endl;
+    return failures == 0 ? 0 : 1;
+}
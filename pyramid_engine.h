@@ -0,0 +1,453 @@
+#ifndef PYRAMID_ENGINE_H
+#define PYRAMID_ENGINE_H
+
+// ============================================
+// HEADLESS ENGINE
+// The game rules with no raylib, no heap and no pointers, so a single game
+// fits in a few hundred bytes. PyramidSolitaire and the tools all play on it.
+// ============================================
+
+#include <type_traits>
+
+const int PYRAMID_ROWS = 7;
+const int PYRAMID_CARDS = 28;
+const int DECK_SIZE = 52;
+const int STOCK_SIZE = DECK_SIZE - PYRAMID_CARDS;
+
+const int NO_SLOT = -1;
+
+// A card packed into one byte: value 1–13 in the low nibble, suit 0–3 above it
+inline unsigned char packCard(int value, int suit) {
+    return (unsigned char)((suit << 4) | value);
+}
+
+inline int cardValue(unsigned char c) {
+    return c & 0x0F;
+}
+
+inline int cardSuit(unsigned char c) {
+    return c >> 4;
+}
+
+// Slot numbering follows the dealt order: 0–27 are the pyramid rows from the
+// top down, 28–51 are the stock in draw order
+inline int pyramidSlot(int row, int col) {
+    return row * (row + 1) / 2 + col;
+}
+
+inline int slotRow(int slot) {
+    static const unsigned char rows[PYRAMID_CARDS] = {
+        0, 1, 1, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4,
+        5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6
+    };
+    return rows[slot];
+}
+
+// Small deterministic RNG so every session can be reseeded independently
+inline unsigned int nextRandom(unsigned int& seed) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// The cards of one deal, in dealt order
+struct Deal
+{
+    unsigned char cards[DECK_SIZE];
+};
+
+inline void shuffleDeal(Deal& deal, unsigned int seed) {
+    if (seed == 0)
+        seed = 0x9E3779B9u;
+
+    int index = 0;
+    for (int suit = 0; suit < 4; suit++) {
+        for (int value = 1; value <= 13; value++) {
+            deal.cards[index++] = packCard(value, suit);
+        }
+    }
+
+    for (int i = DECK_SIZE - 1; i > 0; i--) {
+        int j = nextRandom(seed) % (i + 1);
+        unsigned char temp = deal.cards[i];
+        deal.cards[i] = deal.cards[j];
+        deal.cards[j] = temp;
+    }
+}
+
+// ============================================
+// RULE POLICIES
+// Each variant is a set of compile-time constants; PyramidEngine<Rules> is
+// instantiated once per variant so the rules fold into the generated code.
+// ============================================
+
+// The rules PyramidSolitaire plays
+struct ClassicRules
+{
+    static const int PAIR_TARGET = 13;      // two free cards summing to this are removed
+    static const int SINGLE_VALUE = 13;     // value removed on its own, 0 for none
+    static const int DRAW_COUNT = 1;        // cards turned per draw
+    static const int RECYCLE_LIMIT = -1;    // times the stock may be turned over, -1 for no limit
+    static const bool WASTE_PAIRS = false;  // card under the waste top is also playable
+};
+
+struct DrawThreeRules
+{
+    static const int PAIR_TARGET = 13;
+    static const int SINGLE_VALUE = 13;
+    static const int DRAW_COUNT = 3;
+    static const int RECYCLE_LIMIT = 2;
+    static const bool WASTE_PAIRS = true;
+};
+
+struct SinglePassRules
+{
+    static const int PAIR_TARGET = 13;
+    static const int SINGLE_VALUE = 13;
+    static const int DRAW_COUNT = 1;
+    static const int RECYCLE_LIMIT = 0;
+    static const bool WASTE_PAIRS = false;
+};
+
+// Everything that changes while a deal is played
+struct GameState
+{
+    unsigned long long removed;  // bit per slot, set once the card is out of play
+    int score;
+    int moves;
+    unsigned char stockCursor;   // stock cards before this one have been drawn this pass
+    unsigned char passes;        // how many times the stock has been recycled
+    signed char selected;        // first selected slot, NO_SLOT when nothing is selected
+    bool won;
+    bool lost;
+};
+
+// Search and what-if code branch by copying positions, so keep this a small
+// plain value: no pointers, nothing owned
+static_assert(std::is_trivially_copyable<GameState>::value, "GameState must be trivially copyable");
+static_assert(sizeof(GameState) <= 32, "GameState must stay small enough to copy freely");
+
+inline void resetState(GameState& st) {
+    st.removed = 0;
+    st.score = 0;
+    st.moves = 0;
+    st.stockCursor = 0;
+    st.passes = 0;
+    st.selected = NO_SLOT;
+    st.won = false;
+    st.lost = false;
+}
+
+inline bool isRemoved(const GameState& st, int slot) {
+    return (st.removed >> slot) & 1ULL;
+}
+
+// Last card drawn this pass that is still in play, NO_SLOT if none
+inline int wasteTop(const GameState& st) {
+    for (int i = st.stockCursor - 1; i >= 0; i--) {
+        if (!isRemoved(st, PYRAMID_CARDS + i))
+            return PYRAMID_CARDS + i;
+    }
+    return NO_SLOT;
+}
+
+// The card under the waste top, NO_SLOT if none
+inline int wasteSecond(const GameState& st) {
+    int top = wasteTop(st);
+    if (top == NO_SLOT)
+        return NO_SLOT;
+
+    for (int i = top - PYRAMID_CARDS - 1; i >= 0; i--) {
+        if (!isRemoved(st, PYRAMID_CARDS + i))
+            return PYRAMID_CARDS + i;
+    }
+    return NO_SLOT;
+}
+
+inline bool isPyramidSlotFree(const GameState& st, int slot) {
+    if (isRemoved(st, slot))
+        return false;
+
+    int row = slotRow(slot);
+    if (row == PYRAMID_ROWS - 1)
+        return true;
+
+    int col = slot - pyramidSlot(row, 0);
+    int left = pyramidSlot(row + 1, col);
+    return isRemoved(st, left) && isRemoved(st, left + 1);
+}
+
+template<class Rules = ClassicRules>
+class PyramidEngine {
+public:
+    static bool isSlotFree(const GameState& st, int slot) {
+        if (slot < 0 || slot >= DECK_SIZE)
+            return false;
+
+        if (slot < PYRAMID_CARDS)
+            return isPyramidSlotFree(st, slot);
+
+        if (isRemoved(st, slot))
+            return false;
+
+        if (slot == wasteTop(st))
+            return true;
+
+        return Rules::WASTE_PAIRS && slot == wasteSecond(st);
+    }
+
+    static bool isSingle(int value) {
+        return Rules::SINGLE_VALUE != 0 && value == Rules::SINGLE_VALUE;
+    }
+
+    static bool isPair(int value1, int value2) {
+        return value1 + value2 == Rules::PAIR_TARGET;
+    }
+
+    // ----------------------------------------
+    // Rules shared with TableEngine, which keeps its own state and removal
+    // bookkeeping but must play exactly this game
+    // ----------------------------------------
+
+    template<class State>
+    static bool canRecycle(const State& st) {
+        return Rules::RECYCLE_LIMIT < 0 || st.passes < Rules::RECYCLE_LIMIT;
+    }
+
+    // counts[v] is how many playable cards of value v there are
+    static bool hasMove(const int* counts) {
+        for (int v = 1; v <= 13; v++) {
+            if (counts[v] == 0)
+                continue;
+            if (isSingle(v))
+                return true;
+
+            int partner = Rules::PAIR_TARGET - v;
+            if (partner < 1 || partner > 13)
+                continue;
+            if (partner == v ? counts[v] >= 2 : counts[partner] > 0)
+                return true;
+        }
+        return false;
+    }
+
+    // Stock index just after the last card a draw turns, given the first
+    // one. nextInStock(i) is the first stock card in play at or after i,
+    // stockSize when there is none. Sets drawn to how many were turned.
+    template<class NextInStock>
+    static int drawEnd(int first, int stockSize, NextInStock nextInStock, int& drawn) {
+        int next = first;
+        drawn = 1;
+        while (drawn < Rules::DRAW_COUNT) {
+            int after = nextInStock(next + 1);
+            if (after == stockSize)
+                break;
+            next = after;
+            drawn++;
+        }
+        return next + 1;
+    }
+
+    // One click on a free card: singles go straight away, otherwise the
+    // second selection either completes a pair or clears both. take(slot)
+    // puts a card out of play; returns true when cards were taken.
+    template<class DealType, class State, class Take>
+    static bool click(const DealType& deal, State& st, int slot, Take take) {
+        int value = cardValue(deal.cards[slot]);
+
+        if (isSingle(value)) {
+            take(slot);
+            st.score += 10;
+            st.moves++;
+            st.selected = NO_SLOT;
+            return true;
+        }
+
+        if (st.selected == NO_SLOT) {
+            st.selected = slot;
+            return false;
+        }
+
+        if (st.selected == slot) {
+            st.selected = NO_SLOT;
+            return false;
+        }
+
+        int first = st.selected;
+        st.selected = NO_SLOT;
+        st.moves++;
+
+        if (!isPair(cardValue(deal.cards[first]), value))
+            return false;
+
+        take(first);
+        take(slot);
+        st.score += 20;
+        return true;
+    }
+
+    // True while a draw could still bring a new card into play
+    static bool stockHasCards(const GameState& st) {
+        for (int i = st.stockCursor; i < STOCK_SIZE; i++) {
+            if (!isRemoved(st, PYRAMID_CARDS + i))
+                return true;
+        }
+
+        if (!canRecycle(st))
+            return false;
+
+        unsigned long long stockMask = ((1ULL << STOCK_SIZE) - 1) << PYRAMID_CARDS;
+        return (st.removed & stockMask) != stockMask;
+    }
+
+    static void checkWin(GameState& st) {
+        unsigned long long pyramidMask = (1ULL << PYRAMID_CARDS) - 1;
+        if ((st.removed & pyramidMask) == pyramidMask)
+            st.won = true;
+    }
+
+    static void checkLose(const Deal& deal, GameState& st) {
+        int counts[14] = { 0 };
+
+        for (int slot = 0; slot < PYRAMID_CARDS; slot++) {
+            if (isPyramidSlotFree(st, slot))
+                counts[cardValue(deal.cards[slot])]++;
+        }
+
+        int waste = wasteTop(st);
+        if (waste != NO_SLOT)
+            counts[cardValue(deal.cards[waste])]++;
+
+        if (Rules::WASTE_PAIRS) {
+            int second = wasteSecond(st);
+            if (second != NO_SLOT)
+                counts[cardValue(deal.cards[second])]++;
+        }
+
+        if (hasMove(counts))
+            return;
+
+        if (stockHasCards(st))
+            return;
+
+        st.lost = true;
+    }
+
+    // Turns up to DRAW_COUNT cards. Returns false when there is nothing left to draw.
+    static bool drawFromStock(GameState& st) {
+        int next = st.stockCursor;
+        while (next < STOCK_SIZE && isRemoved(st, PYRAMID_CARDS + next))
+            next++;
+
+        if (next == STOCK_SIZE) {
+            if (!canRecycle(st))
+                return false;
+
+            next = 0;
+            while (next < STOCK_SIZE && isRemoved(st, PYRAMID_CARDS + next))
+                next++;
+
+            if (next == STOCK_SIZE)
+                return false;
+
+            st.passes++;
+        }
+
+        int drawn;
+        int end = drawEnd(next, STOCK_SIZE, [&st](int index) {
+            while (index < STOCK_SIZE && isRemoved(st, PYRAMID_CARDS + index))
+                index++;
+            return index;
+        }, drawn);
+
+        st.stockCursor = (unsigned char)end;
+        st.selected = NO_SLOT;
+        st.moves++;
+        return true;
+    }
+
+    // A click on any card; see click() for what it does to a free one
+    static void selectSlot(const Deal& deal, GameState& st, int slot) {
+        if (st.won || st.lost || !isSlotFree(st, slot))
+            return;
+
+        if (click(deal, st, slot, [&st](int taken) { st.removed |= 1ULL << taken; }))
+            checkWin(st);
+    }
+};
+
+const int MAX_CHILDREN = 64;
+
+// Positions reachable in one move. Moves are whole removals (a king or a
+// pair) and draws; selection is only a UI concept. With pruneSingles a free
+// single that can be taken without changing any later draw is the only move
+// returned, which never changes win or loss.
+template<class Rules>
+int childPositions(const Deal& deal, const GameState& st, GameState* children, bool pruneSingles = true) {
+    typedef PyramidEngine<Rules> Engine;
+
+    int slots[PYRAMID_CARDS + 2];
+    int count = 0;
+    for (int slot = 0; slot < PYRAMID_CARDS; slot++) {
+        if (isPyramidSlotFree(st, slot))
+            slots[count++] = slot;
+    }
+
+    int waste = wasteTop(st);
+    if (waste != NO_SLOT)
+        slots[count++] = waste;
+
+    if (Rules::WASTE_PAIRS) {
+        int second = wasteSecond(st);
+        if (second != NO_SLOT)
+            slots[count++] = second;
+    }
+
+    // A free single card only ever blocks others, so taking it is never
+    // worse than any alternative and is the only move worth trying. Not
+    // from the waste when cards are drawn in groups, though: it changes
+    // which cards are turned up together from then on.
+    for (int i = 0; i < count && pruneSingles; i++) {
+        if (slots[i] >= PYRAMID_CARDS && Rules::DRAW_COUNT > 1)
+            continue;
+        if (Engine::isSingle(cardValue(deal.cards[slots[i]]))) {
+            children[0] = st;
+            children[0].selected = NO_SLOT;
+            Engine::selectSlot(deal, children[0], slots[i]);
+            return 1;
+        }
+    }
+
+    int made = 0;
+    for (int i = 0; i < count; i++) {
+        int value = cardValue(deal.cards[slots[i]]);
+
+        if (Engine::isSingle(value)) {
+            GameState& child = children[made++];
+            child = st;
+            child.selected = NO_SLOT;
+            Engine::selectSlot(deal, child, slots[i]);
+            continue;
+        }
+
+        for (int j = i + 1; j < count && made < MAX_CHILDREN - 1; j++) {
+            if (!Engine::isPair(value, cardValue(deal.cards[slots[j]])))
+                continue;
+
+            GameState& child = children[made++];
+            child = st;
+            child.selected = NO_SLOT;
+            Engine::selectSlot(deal, child, slots[i]);
+            Engine::selectSlot(deal, child, slots[j]);
+        }
+    }
+
+    children[made] = st;
+    if (Engine::drawFromStock(children[made]))
+        made++;
+
+    return made;
+}
+
+#endif
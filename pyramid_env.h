@@ -0,0 +1,251 @@
+#ifndef PYRAMID_ENV_H
+#define PYRAMID_ENV_H
+
+// ============================================
+// BATCHED TRAINING ENVIRONMENT
+// Steps N independent games per call for reinforcement learning. Uses the
+// headless engine, so no raylib and no allocation once constructed.
+// ============================================
+
+#include "pyramid_engine.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Actions 0–27 select a pyramid slot, then select the waste top, select
+// the card under it (only with waste pairs, masked out otherwise), then draw
+const int ACTION_SELECT_WASTE = PYRAMID_CARDS;
+const int ACTION_SELECT_WASTE2 = PYRAMID_CARDS + 1;
+const int ACTION_DRAW = PYRAMID_CARDS + 2;
+const int ACTION_COUNT = PYRAMID_CARDS + 3;
+
+// Observation layout per game, as floats:
+//   [0, 28)   pyramid card value, 0 once removed
+//   [28, 56)  1 if the pyramid card is free
+//   56        waste top value, 0 if empty
+//   57        value under the waste top, 0 if empty or without waste pairs
+//   58        cards left to draw this pass
+//   [59, 89)  1 at the select action of the card waiting for a partner
+const int OBS_RANKS = 0;
+const int OBS_FREE = PYRAMID_CARDS;
+const int OBS_WASTE = 2 * PYRAMID_CARDS;
+const int OBS_WASTE2 = 2 * PYRAMID_CARDS + 1;
+const int OBS_STOCK = 2 * PYRAMID_CARDS + 2;
+const int OBS_SELECTED = 2 * PYRAMID_CARDS + 3;
+const int OBS_SIZE = OBS_SELECTED + ACTION_DRAW;
+
+template<class Rules = ClassicRules>
+class BatchEnv {
+private:
+    typedef PyramidEngine<Rules> Engine;
+
+    int count;
+    int maxSteps;
+    std::vector<Deal> deals;
+    std::vector<GameState> states;
+    std::vector<int> steps;
+    std::vector<unsigned int> seeds;
+
+    // Arguments of the step being run by the worker threads
+    const int* stepActions;
+    float* stepObservations;
+    float* stepRewards;
+    unsigned char* stepDones;
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable startStep;
+    std::condition_variable stepDone;
+    long long generation;
+    int running;
+    bool stopping;
+
+    void resetGame(int i) {
+        shuffleDeal(deals[i], nextRandom(seeds[i]));
+        resetState(states[i]);
+        steps[i] = 0;
+    }
+
+    void observe(int i, float* obs) {
+        const Deal& deal = deals[i];
+        const GameState& st = states[i];
+
+        for (int slot = 0; slot < PYRAMID_CARDS; slot++) {
+            bool inPlay = !isRemoved(st, slot);
+            obs[OBS_RANKS + slot] = inPlay ? (float)cardValue(deal.cards[slot]) : 0.0f;
+            obs[OBS_FREE + slot] = isPyramidSlotFree(st, slot) ? 1.0f : 0.0f;
+        }
+
+        int waste = wasteTop(st);
+        obs[OBS_WASTE] = waste == NO_SLOT ? 0.0f : (float)cardValue(deal.cards[waste]);
+
+        int second = Rules::WASTE_PAIRS ? wasteSecond(st) : NO_SLOT;
+        obs[OBS_WASTE2] = second == NO_SLOT ? 0.0f : (float)cardValue(deal.cards[second]);
+
+        int left = 0;
+        for (int s = st.stockCursor; s < STOCK_SIZE; s++) {
+            if (!isRemoved(st, PYRAMID_CARDS + s))
+                left++;
+        }
+        obs[OBS_STOCK] = (float)left;
+
+        // A pair takes two selects, so the first one has to be visible
+        for (int a = 0; a < ACTION_DRAW; a++) {
+            obs[OBS_SELECTED + a] = 0.0f;
+        }
+        if (st.selected != NO_SLOT) {
+            if (st.selected < PYRAMID_CARDS)
+                obs[OBS_SELECTED + st.selected] = 1.0f;
+            else if (st.selected == waste)
+                obs[OBS_SELECTED + ACTION_SELECT_WASTE] = 1.0f;
+            else if (st.selected == second)
+                obs[OBS_SELECTED + ACTION_SELECT_WASTE2] = 1.0f;
+        }
+    }
+
+    void stepRange(int first, int last) {
+        for (int i = first; i < last; i++) {
+            GameState& st = states[i];
+            int before = st.score;
+            int action = stepActions[i];
+
+            if (action == ACTION_DRAW) {
+                Engine::drawFromStock(st);
+            }
+            else if (action == ACTION_SELECT_WASTE) {
+                Engine::selectSlot(deals[i], st, wasteTop(st));
+            }
+            else if (action == ACTION_SELECT_WASTE2 && Rules::WASTE_PAIRS) {
+                Engine::selectSlot(deals[i], st, wasteSecond(st));
+            }
+            else if (action >= 0 && action < PYRAMID_CARDS) {
+                Engine::selectSlot(deals[i], st, action);
+            }
+            Engine::checkLose(deals[i], st);
+            steps[i]++;
+
+            bool done = st.won || st.lost || steps[i] >= maxSteps;
+            stepRewards[i] = (float)(st.score - before);
+            stepDones[i] = done ? 1 : 0;
+
+            // Finished games restart straight away; the done flag tells the
+            // caller this observation already belongs to the next deal
+            if (done)
+                resetGame(i);
+
+            observe(i, stepObservations + (long long)i * OBS_SIZE);
+        }
+    }
+
+    void workerLoop(int worker, int threadCount) {
+        long long seen = 0;
+        int first = (int)((long long)count * worker / threadCount);
+        int last = (int)((long long)count * (worker + 1) / threadCount);
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                startStep.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+
+            stepRange(first, last);
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                running--;
+            }
+            stepDone.notify_one();
+        }
+    }
+
+public:
+    // threadCount 0 uses every core; 1 steps on the calling thread
+    BatchEnv(int envCount, unsigned int seed, int threadCount = 0, int stepLimit = 1000) {
+        count = envCount;
+        maxSteps = stepLimit;
+        deals.resize(count);
+        states.resize(count);
+        steps.resize(count);
+        seeds.resize(count);
+        generation = 0;
+        running = 0;
+        stopping = false;
+
+        for (int i = 0; i < count; i++) {
+            seeds[i] = seed + 0x9E3779B9u * (unsigned int)(i + 1);
+            resetGame(i);
+        }
+
+        if (threadCount <= 0)
+            threadCount = (int)std::thread::hardware_concurrency();
+        if (threadCount > count)
+            threadCount = count;
+
+        if (threadCount > 1) {
+            workers.reserve(threadCount);
+            for (int t = 0; t < threadCount; t++) {
+                workers.push_back(std::thread(&BatchEnv::workerLoop, this, t, threadCount));
+            }
+        }
+    }
+
+    ~BatchEnv() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        startStep.notify_all();
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+    }
+
+    int size() {
+        return count;
+    }
+
+    // Restarts every game with a fresh deal and writes count * OBS_SIZE floats
+    void reset(float* observations) {
+        for (int i = 0; i < count; i++) {
+            resetGame(i);
+            observe(i, observations + (long long)i * OBS_SIZE);
+        }
+    }
+
+    // Applies actions[i] to game i. Rewards are score gained this step; a game
+    // is done when it is won, lost, or reaches the step limit.
+    void step(const int* actions, float* observations, float* rewards, unsigned char* dones) {
+        stepActions = actions;
+        stepObservations = observations;
+        stepRewards = rewards;
+        stepDones = dones;
+
+        if (workers.empty()) {
+            stepRange(0, count);
+            return;
+        }
+
+        std::unique_lock<std::mutex> guard(lock);
+        running = (int)workers.size();
+        generation++;
+        startStep.notify_all();
+        stepDone.wait(guard, [this] { return running == 0; });
+    }
+
+    // Valid actions for game i, written as ACTION_COUNT 0/1 bytes
+    void actionMask(int i, unsigned char* mask) {
+        const GameState& st = states[i];
+        for (int slot = 0; slot < PYRAMID_CARDS; slot++) {
+            mask[slot] = isPyramidSlotFree(st, slot) ? 1 : 0;
+        }
+        mask[ACTION_SELECT_WASTE] = wasteTop(st) != NO_SLOT ? 1 : 0;
+        mask[ACTION_SELECT_WASTE2] = Rules::WASTE_PAIRS && wasteSecond(st) != NO_SLOT ? 1 : 0;
+        mask[ACTION_DRAW] = Engine::stockHasCards(st) ? 1 : 0;
+    }
+};
+
+#endif
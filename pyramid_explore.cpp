@@ -0,0 +1,547 @@
+// ============================================
+// STATE-SPACE EXPLORER
+// Enumerates every position reachable in one deal, with the shortest
+// distance to each, keeping memory bounded by spilling to disk.
+//
+// Cards never come back, so positions fall into layers by how many cards
+// are gone, and moves only lead to the same layer (draws) or a later one
+// (removals). Layers are finished in order. Removals out of a layer are
+// buffered, sorted and spilled as runs for the layer they land in. A
+// layer is read back by merging its runs, which also drops duplicates.
+// Draws only move through the stock, so each set of remaining cards has at
+// most a hundred positions, and those are settled in memory.
+//   g++ -O2 -std=c++17 pyramid_explore.cpp -o pyramid_explore
+//   ./pyramid_explore --deal 7 --memory 512 --dir /tmp
+// ============================================
+
+#include "pyramid_engine.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace std;
+
+const int MAX_FAN_IN = 128;
+const size_t MIN_READ_BUFFER = 4096;
+const size_t MAX_READ_BUFFER = 1 << 16;
+const int CURSOR_STATES = STOCK_SIZE + 1;
+const int PASS_STATES = 4;
+
+// Position key: removed cards above the stock cursor and the pass count,
+// so sorting keys groups positions with the same cards left
+#pragma pack(push, 4)
+struct Record
+{
+    unsigned long long key;
+    unsigned int distance;
+};
+#pragma pack(pop)
+
+bool recordLess(const Record& a, const Record& b) {
+    return a.key < b.key;
+}
+
+unsigned long long removedOf(unsigned long long key) {
+    return key >> 7;
+}
+
+// Cursors only matter through the waste top: put it just past that card,
+// so positions that play the same share a key
+template<class Rules>
+unsigned long long encode(const GameState& st) {
+    int top = wasteTop(st);
+    unsigned long long cursor = top == NO_SLOT ? 0 : (unsigned long long)(top - PYRAMID_CARDS + 1);
+    unsigned long long passes = Rules::RECYCLE_LIMIT < 0 ? 0 : st.passes;
+    return (st.removed << 7) | (cursor << 2) | passes;
+}
+
+void decode(unsigned long long key, GameState& st) {
+    resetState(st);
+    st.removed = removedOf(key);
+    st.stockCursor = (unsigned char)((key >> 2) & 31);
+    st.passes = (unsigned char)(key & 3);
+    unsigned long long pyramidMask = (1ULL << PYRAMID_CARDS) - 1;
+    st.won = (st.removed & pyramidMask) == pyramidMask;
+}
+
+// Collects records for one layer and spills them to disk as sorted runs
+class RunWriter {
+private:
+    vector<Record> buffer;
+    size_t capacity;
+    string prefix;
+    int runCount;
+
+public:
+    vector<string> runs;
+    long long bytesWritten;
+
+    RunWriter() {
+        capacity = 0;
+        runCount = 0;
+        bytesWritten = 0;
+    }
+
+    void open(const string& filePrefix, size_t records) {
+        prefix = filePrefix;
+        capacity = records;
+    }
+
+    void reserve() {
+        buffer.reserve(capacity);
+    }
+
+    // Takes over the buffer of a layer that has been flushed, so the same
+    // two allocations serve every layer
+    void takeBuffer(RunWriter& flushed) {
+        buffer.swap(flushed.buffer);
+        buffer.clear();
+    }
+
+    bool add(const Record& r) {
+        buffer.push_back(r);
+        return buffer.size() < capacity || flush();
+    }
+
+    // Sorted, with each key once at its shortest distance
+    bool flush() {
+        if (buffer.empty())
+            return true;
+
+        sort(buffer.begin(), buffer.end(), recordLess);
+        size_t kept = 0;
+        for (size_t i = 0; i < buffer.size(); i++) {
+            if (kept > 0 && buffer[kept - 1].key == buffer[i].key) {
+                if (buffer[i].distance < buffer[kept - 1].distance)
+                    buffer[kept - 1].distance = buffer[i].distance;
+                continue;
+            }
+            buffer[kept++] = buffer[i];
+        }
+
+        string path = nextRunPath();
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        bool ok = fwrite(&buffer[0], sizeof(Record), kept, file) == kept;
+        if (fclose(file) != 0 || !ok) {
+            remove(path.c_str());
+            return false;
+        }
+
+        runs.push_back(path);
+        bytesWritten += (long long)kept * sizeof(Record);
+        buffer.clear();
+        return true;
+    }
+
+    string nextRunPath() {
+        return prefix + "-" + to_string(runCount++) + ".run";
+    }
+
+    void release() {
+        vector<Record>().swap(buffer);
+        runs.clear();
+        runCount = 0;
+    }
+};
+
+// K-way merge of sorted runs, calling emit once per key with its shortest distance
+class RunMerger {
+private:
+    struct Source
+    {
+        FILE* file;
+        Record current;
+    };
+
+    vector<Source> sources;
+    vector<int> heap;   // indexes into sources, smallest key on top
+
+    bool heapLess(int a, int b) {
+        return sources[a].current.key > sources[b].current.key;
+    }
+
+public:
+    bool open(const vector<string>& paths, size_t readBuffer) {
+        for (size_t i = 0; i < paths.size(); i++) {
+            Source s;
+            s.file = fopen(paths[i].c_str(), "rb");
+            if (!s.file)
+                return false;
+            setvbuf(s.file, nullptr, _IOFBF, readBuffer);
+            if (fread(&s.current, sizeof(Record), 1, s.file) == 1) {
+                sources.push_back(s);
+                heap.push_back((int)sources.size() - 1);
+            }
+            else {
+                fclose(s.file);
+            }
+        }
+        make_heap(heap.begin(), heap.end(), [this](int a, int b) { return heapLess(a, b); });
+        return true;
+    }
+
+    // Next distinct key; false once every run is used up
+    bool next(Record& out) {
+        if (heap.empty())
+            return false;
+
+        out = sources[heap.front()].current;
+        while (!heap.empty() && sources[heap.front()].current.key == out.key) {
+            int top = heap.front();
+            if (sources[top].current.distance < out.distance)
+                out.distance = sources[top].current.distance;
+
+            pop_heap(heap.begin(), heap.end(), [this](int a, int b) { return heapLess(a, b); });
+            if (fread(&sources[top].current, sizeof(Record), 1, sources[top].file) == 1) {
+                push_heap(heap.begin(), heap.end(), [this](int a, int b) { return heapLess(a, b); });
+            }
+            else {
+                heap.pop_back();
+            }
+        }
+        return true;
+    }
+
+    void close() {
+        for (size_t i = 0; i < sources.size(); i++) {
+            fclose(sources[i].file);
+        }
+        sources.clear();
+        heap.clear();
+    }
+};
+
+struct ExploreStats
+{
+    long long states;
+    long long deadEnds;
+    long long wins;
+    unsigned int shortestWin;
+    long long peakDisk;
+    long long diskNow;
+};
+
+struct ExploreOptions
+{
+    unsigned int seed;
+    size_t memoryBytes;
+    string directory;
+    bool verbose;
+};
+
+template<class Rules>
+class Explorer {
+private:
+    typedef PyramidEngine<Rules> Engine;
+
+    const Deal& deal;
+    const ExploreOptions& options;
+    RunWriter layers[DECK_SIZE + 1];
+    string prefix;
+    ExploreStats stats;
+    size_t readBuffer;      // stdio buffer per open run
+
+    // Every position with these cards left, by cursor and pass count
+    unsigned int groupDistance[CURSOR_STATES][PASS_STATES];
+
+    void useDisk(long long bytes) {
+        stats.diskNow += bytes;
+        if (stats.diskNow > stats.peakDisk)
+            stats.peakDisk = stats.diskNow;
+    }
+
+    bool emit(const GameState& child, unsigned int distance) {
+        int layer = __builtin_popcountll(child.removed);
+        Record r = { encode<Rules>(child), distance };
+        long long before = layers[layer].bytesWritten;
+        bool ok = layers[layer].add(r);
+        useDisk(layers[layer].bytesWritten - before);
+        return ok;
+    }
+
+    // Settles draws within one set of remaining cards, then counts each
+    // position and sends its removals on to later layers
+    bool finishGroup(unsigned long long removed) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int c = 0; c < CURSOR_STATES; c++) {
+                for (int p = 0; p < PASS_STATES; p++) {
+                    if (groupDistance[c][p] == UINT_MAX)
+                        continue;
+
+                    GameState st;
+                    decode((removed << 7) | ((unsigned long long)c << 2) | p, st);
+                    if (st.won || !Engine::drawFromStock(st))
+                        continue;
+
+                    unsigned long long key = encode<Rules>(st);
+                    unsigned int& target = groupDistance[(key >> 2) & 31][key & 3];
+                    if (groupDistance[c][p] + 1 < target) {
+                        target = groupDistance[c][p] + 1;
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        for (int c = 0; c < CURSOR_STATES; c++) {
+            for (int p = 0; p < PASS_STATES; p++) {
+                unsigned int distance = groupDistance[c][p];
+                if (distance == UINT_MAX)
+                    continue;
+                groupDistance[c][p] = UINT_MAX;
+
+                GameState st;
+                decode((removed << 7) | ((unsigned long long)c << 2) | p, st);
+                stats.states++;
+
+                if (st.won) {
+                    stats.wins++;
+                    if (distance < stats.shortestWin)
+                        stats.shortestWin = distance;
+                    continue;
+                }
+
+                GameState children[MAX_CHILDREN];
+                int count = childPositions<Rules>(deal, st, children, false);
+                if (count == 0)
+                    stats.deadEnds++;
+
+                for (int i = 0; i < count; i++) {
+                    if (children[i].removed != st.removed && !emit(children[i], distance + 1))
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Merges runs down until one merge can take them all at once. Each
+    // batch goes straight to a single new run, not through the buffer.
+    bool reduceRuns(int layer) {
+        RunWriter& writer = layers[layer];
+        while (writer.runs.size() > (size_t)MAX_FAN_IN) {
+            vector<string> all;
+            all.swap(writer.runs);
+            for (size_t first = 0; first < all.size(); first += MAX_FAN_IN) {
+                size_t last = min(all.size(), first + MAX_FAN_IN);
+                vector<string> batch(all.begin() + first, all.begin() + last);
+
+                string path = writer.nextRunPath();
+                FILE* file = fopen(path.c_str(), "wb");
+                RunMerger merger;
+                if (!file || !merger.open(batch, readBuffer)) {
+                    if (file)
+                        fclose(file);
+                    return false;
+                }
+                setvbuf(file, nullptr, _IOFBF, readBuffer);
+
+                bool ok = true;
+                long long written = 0;
+                Record r;
+                while (ok && merger.next(r)) {
+                    ok = fwrite(&r, sizeof(Record), 1, file) == 1;
+                    written += sizeof(Record);
+                }
+                merger.close();
+                if (fclose(file) != 0 || !ok)
+                    return false;
+
+                writer.runs.push_back(path);
+                useDisk(written);
+                for (size_t i = 0; i < batch.size(); i++) {
+                    useDisk(-fileSize(batch[i]));
+                    remove(batch[i].c_str());
+                }
+            }
+        }
+        return true;
+    }
+
+    static long long fileSize(const string& path) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return 0;
+        fseek(file, 0, SEEK_END);
+        long long size = ftell(file);
+        fclose(file);
+        return size;
+    }
+
+    bool exploreLayer(int layer) {
+        RunWriter& writer = layers[layer];
+        long long flushed = writer.bytesWritten;
+        if (!writer.flush())
+            return false;
+        useDisk(writer.bytesWritten - flushed);
+
+        // Everything is on disk now, so the buffer moves on to the layer two
+        // further on rather than sitting idle while the runs are merged.
+        // Layer 0 only ever held the start; layer 2 has its own.
+        if (layer >= 1 && layer + 2 <= DECK_SIZE)
+            layers[layer + 2].takeBuffer(writer);
+        if (!reduceRuns(layer))
+            return false;
+
+        vector<string> runs = writer.runs;
+        long long before = stats.states;
+
+        RunMerger merger;
+        if (!merger.open(runs, readBuffer))
+            return false;
+
+        bool ok = true;
+        bool haveGroup = false;
+        unsigned long long group = 0;
+        Record r;
+        while (ok && merger.next(r)) {
+            if (haveGroup && removedOf(r.key) != group)
+                ok = finishGroup(group);
+            group = removedOf(r.key);
+            haveGroup = true;
+            unsigned int& slot = groupDistance[(r.key >> 2) & 31][r.key & 3];
+            if (r.distance < slot)
+                slot = r.distance;
+        }
+        if (ok && haveGroup)
+            ok = finishGroup(group);
+        merger.close();
+
+        for (size_t i = 0; i < runs.size(); i++) {
+            useDisk(-fileSize(runs[i]));
+            remove(runs[i].c_str());
+        }
+        writer.release();
+
+        if (options.verbose && stats.states > before) {
+            cerr << "removed=" << layer << " states=" << stats.states - before
+                 << " disk=" << stats.diskNow << endl;
+        }
+        return ok;
+    }
+
+public:
+    Explorer(const Deal& d, const ExploreOptions& o) : deal(d), options(o) {
+        readBuffer = MIN_READ_BUFFER;
+        stats.states = 0;
+        stats.deadEnds = 0;
+        stats.wins = 0;
+        stats.shortestWin = UINT_MAX;
+        stats.peakDisk = 0;
+        stats.diskNow = 0;
+        for (int c = 0; c < CURSOR_STATES; c++) {
+            for (int p = 0; p < PASS_STATES; p++) {
+                groupDistance[c][p] = UINT_MAX;
+            }
+        }
+    }
+
+    bool run() {
+        prefix = options.directory + "/pyramid-explore-" + to_string((long long)getpid());
+
+        // A quarter of the budget reads runs back, one buffer per run merged
+        // at once. Removals land one or two layers on, so only those two
+        // layers hold a record buffer at a time, and they share the rest.
+        readBuffer = options.memoryBytes / 4 / MAX_FAN_IN;
+        readBuffer = min(max(readBuffer, MIN_READ_BUFFER), MAX_READ_BUFFER);
+        size_t records = (options.memoryBytes - options.memoryBytes / 4) / 2 / sizeof(Record);
+        if (records < 1024)
+            records = 1024;
+
+        // Buffers are allocated once, for the two layers after the start;
+        // each later layer inherits one from the layer two before it. Freeing
+        // and reallocating them instead fragments the heap past the budget.
+        for (int layer = 0; layer <= DECK_SIZE; layer++) {
+            layers[layer].open(prefix + "-L" + to_string(layer), records);
+        }
+        layers[1].reserve();
+        layers[2].reserve();
+
+        GameState start;
+        resetState(start);
+        bool ok = emit(start, 0);
+        for (int layer = 0; layer <= DECK_SIZE && ok; layer++) {
+            ok = exploreLayer(layer);
+        }
+        return ok;
+    }
+
+    const ExploreStats& result() {
+        return stats;
+    }
+};
+
+template<class Rules>
+int explore(const ExploreOptions& options) {
+    Deal deal;
+    shuffleDeal(deal, options.seed);
+
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    Explorer<Rules> explorer(deal, options);
+    if (!explorer.run()) {
+        cerr << "could not write runs to " << options.directory << endl;
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    const ExploreStats& stats = explorer.result();
+    cout << "deal=" << options.seed
+         << " states=" << stats.states
+         << " dead_ends=" << stats.deadEnds
+         << " wins=" << stats.wins
+         << " shortest_win=";
+    if (stats.shortestWin == UINT_MAX)
+        cout << "none";
+    else
+        cout << stats.shortestWin;
+    cout << " peak_disk=" << stats.peakDisk
+         << " seconds=" << seconds << endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    ExploreOptions options;
+    options.seed = 1;
+    options.memoryBytes = 256u << 20;
+    options.directory = ".";
+    options.verbose = false;
+    string rules = "classic";
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--deal" && i + 1 < argc)
+            options.seed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--memory" && i + 1 < argc)
+            options.memoryBytes = (size_t)atoll(argv[++i]) << 20;
+        else if (arg == "--dir" && i + 1 < argc)
+            options.directory = argv[++i];
+        else if (arg == "--rules" && i + 1 < argc)
+            rules = argv[++i];
+        else if (arg == "-v")
+            options.verbose = true;
+        else {
+            cerr << "usage: pyramid_explore [--deal SEED] [--memory MB] [--dir PATH]"
+                 << " [--rules classic|draw3|single-pass] [-v]" << endl;
+            return 1;
+        }
+    }
+
+    if (rules == "classic")
+        return explore<ClassicRules>(options);
+    if (rules == "draw3")
+        return explore<DrawThreeRules>(options);
+    if (rules == "single-pass")
+        return explore<SinglePassRules>(options);
+
+    cerr << "unknown rules: " << rules << endl;
+    return 1;
+}
@@ -0,0 +1,176 @@
+#ifndef PYRAMID_PLAYER_H
+#define PYRAMID_PLAYER_H
+
+// ============================================
+// HEURISTIC PLAYER
+// Plays a deal move by move with no lookahead: every removal on offer is
+// scored with a set of tunable weights and the best one is made, unless
+// drawing scores higher. Deterministic, so a deal and a set of weights
+// always give the same game.
+// ============================================
+
+#include "pyramid_engine.h"
+
+// A removal scores the sum of the terms that apply to it
+struct PlayerWeights
+{
+    double pyramidPair;    // both cards come from the pyramid
+    double wastePair;      // one card comes from the waste
+    double uncover;        // per pyramid card the removal sets free
+    double depth;          // per row above the bottom, for each pyramid card removed
+    double king;           // removing a king; below drawBias holds kings back
+    double drawBias;       // what a draw scores; removals have to beat it
+};
+
+inline void defaultWeights(PlayerWeights& w) {
+    w.pyramidPair = 1.0;
+    w.wastePair = 0.5;
+    w.uncover = 1.0;
+    w.depth = 0.2;
+    w.king = 2.0;
+    w.drawBias = 0.0;
+}
+
+template<class Rules = ClassicRules>
+class HeuristicPlayer {
+private:
+    typedef PyramidEngine<Rules> Engine;
+
+    static int freePyramidCards(const GameState& st) {
+        int count = 0;
+        for (int slot = 0; slot < PYRAMID_CARDS; slot++) {
+            if (isPyramidSlotFree(st, slot))
+                count++;
+        }
+        return count;
+    }
+
+    static double depthOf(int slot) {
+        return slot < PYRAMID_CARDS ? (double)(PYRAMID_ROWS - 1 - slotRow(slot)) : 0.0;
+    }
+
+    static double scoreRemoval(const GameState& st, const GameState& after, int slot1, int slot2,
+                               const PlayerWeights& w) {
+        double score = 0.0;
+
+        if (slot2 == NO_SLOT)
+            score += w.king;
+        else if (slot1 >= PYRAMID_CARDS || slot2 >= PYRAMID_CARDS)
+            score += w.wastePair;
+        else
+            score += w.pyramidPair;
+
+        score += w.depth * (depthOf(slot1) + (slot2 == NO_SLOT ? 0.0 : depthOf(slot2)));
+
+        // Cards still free afterwards were free before, so the difference
+        // plus what was removed from the pyramid is what the move uncovered
+        int removedFromPyramid = (slot1 < PYRAMID_CARDS ? 1 : 0)
+            + (slot2 != NO_SLOT && slot2 < PYRAMID_CARDS ? 1 : 0);
+        score += w.uncover * (freePyramidCards(after) - freePyramidCards(st) + removedFromPyramid);
+        return score;
+    }
+
+public:
+    // Makes one move. Returns false when there is nothing left to do.
+    // With mustRemove a removal is made whatever it scores, if there is one.
+    static bool playMove(const Deal& deal, GameState& st, const PlayerWeights& w, bool mustRemove = false) {
+        int slots[PYRAMID_CARDS + 2];
+        int count = 0;
+        for (int slot = 0; slot < PYRAMID_CARDS; slot++) {
+            if (isPyramidSlotFree(st, slot))
+                slots[count++] = slot;
+        }
+
+        int waste = wasteTop(st);
+        if (waste != NO_SLOT)
+            slots[count++] = waste;
+
+        if (Rules::WASTE_PAIRS) {
+            int second = wasteSecond(st);
+            if (second != NO_SLOT)
+                slots[count++] = second;
+        }
+
+        bool found = false;
+        double bestScore = 0.0;
+        GameState best;
+
+        for (int i = 0; i < count; i++) {
+            int value = cardValue(deal.cards[slots[i]]);
+
+            if (Engine::isSingle(value)) {
+                GameState after = st;
+                after.selected = NO_SLOT;
+                Engine::selectSlot(deal, after, slots[i]);
+                double score = scoreRemoval(st, after, slots[i], NO_SLOT, w);
+                if (!found || score > bestScore) {
+                    found = true;
+                    bestScore = score;
+                    best = after;
+                }
+                continue;
+            }
+
+            for (int j = i + 1; j < count; j++) {
+                if (!Engine::isPair(value, cardValue(deal.cards[slots[j]])))
+                    continue;
+
+                GameState after = st;
+                after.selected = NO_SLOT;
+                Engine::selectSlot(deal, after, slots[i]);
+                Engine::selectSlot(deal, after, slots[j]);
+                double score = scoreRemoval(st, after, slots[i], slots[j], w);
+                if (!found || score > bestScore) {
+                    found = true;
+                    bestScore = score;
+                    best = after;
+                }
+            }
+        }
+
+        if (found && (mustRemove || bestScore > w.drawBias)) {
+            st = best;
+            return true;
+        }
+
+        if (!mustRemove && Engine::drawFromStock(st))
+            return true;
+
+        // Out of draws: take the best removal even if it scores below a draw
+        if (found) {
+            st = best;
+            return true;
+        }
+        return false;
+    }
+
+    // Plays the deal to the end and returns the final position. A pass
+    // through the stock that removes nothing would repeat forever, so then
+    // the best removal is forced; with none left the game is lost, as it
+    // is after maxMoves.
+    static GameState playGame(const Deal& deal, const PlayerWeights& w, int maxMoves = 2000) {
+        GameState st;
+        resetState(st);
+        unsigned long long removedAtRecycle = 0;
+        bool recycled = false;
+
+        for (int move = 0; move < maxMoves && !st.won; move++) {
+            int passes = st.passes;
+            if (!playMove(deal, st, w))
+                break;
+
+            if (st.passes != passes) {
+                if (recycled && st.removed == removedAtRecycle && !playMove(deal, st, w, true))
+                    break;
+                recycled = true;
+                removedAtRecycle = st.removed;
+            }
+        }
+
+        if (!st.won)
+            st.lost = true;
+        return st;
+    }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef PYRAMID_PRECHECK_H
+#define PYRAMID_PRECHECK_H
+
+// ============================================
+// STATIC PRE-CHECK
+// Rejects deals that are dead from the layout alone, before any search.
+// Only ever answers "dead" when that is certain; false means "maybe winnable".
+// ============================================
+
+#include "pyramid_engine.h"
+
+// Bit b of masks[s] is set when pyramid slot b sits in the cone below s,
+// i.e. b has to be removed before s can become free
+struct CoverTable
+{
+    unsigned int masks[PYRAMID_CARDS];
+
+    CoverTable() {
+        for (int s = 0; s < PYRAMID_CARDS; s++) {
+            int row = slotRow(s);
+            int col = s - pyramidSlot(row, 0);
+            masks[s] = 0;
+            for (int r = row + 1; r < PYRAMID_ROWS; r++) {
+                for (int c = col; c <= col + (r - row); c++) {
+                    masks[s] |= 1u << pyramidSlot(r, c);
+                }
+            }
+        }
+    }
+};
+
+inline unsigned int coverMask(int slot) {
+    static const CoverTable table;
+    return table.masks[slot];
+}
+
+// Two cards can be free at the same time unless one has to go before the other
+inline bool canMeet(int slot1, int slot2) {
+    if (slot1 >= PYRAMID_CARDS || slot2 >= PYRAMID_CARDS)
+        return true;
+    return !((coverMask(slot1) >> slot2) & 1) && !((coverMask(slot2) >> slot1) & 1);
+}
+
+// Tries to give every pyramid card in "low" or "high" its own partner from
+// the other group. Stock cards may stay unpaired.
+inline bool canPairAll(const int* low, int lowCount, const int* high, int highCount, int index, unsigned int usedHigh) {
+    if (index == lowCount) {
+        for (int j = 0; j < highCount; j++) {
+            if (high[j] < PYRAMID_CARDS && !((usedHigh >> j) & 1))
+                return false;
+        }
+        return true;
+    }
+
+    for (int j = 0; j < highCount; j++) {
+        if (((usedHigh >> j) & 1) || !canMeet(low[index], high[j]))
+            continue;
+        if (canPairAll(low, lowCount, high, highCount, index + 1, usedHigh | (1u << j)))
+            return true;
+    }
+
+    if (low[index] >= PYRAMID_CARDS)
+        return canPairAll(low, lowCount, high, highCount, index + 1, usedHigh);
+    return false;
+}
+
+// Every pyramid card must leave the table, either alone (a single) or with a
+// partner it can be free together with. For each pair of values that sum to
+// the target this is a small matching problem; if any has no matching that
+// covers all of its pyramid cards, the deal cannot be won.
+template<class Rules>
+bool isStaticallyDead(const Deal& deal) {
+    int slotsByValue[14][DECK_SIZE];
+    int countByValue[14] = { 0 };
+
+    for (int slot = 0; slot < DECK_SIZE; slot++) {
+        int value = cardValue(deal.cards[slot]);
+        slotsByValue[value][countByValue[value]++] = slot;
+    }
+
+    for (int value = 1; value <= 13; value++) {
+        if (PyramidEngine<Rules>::isSingle(value))
+            continue;
+
+        int partner = Rules::PAIR_TARGET - value;
+        if (partner < value && partner >= 1 && !PyramidEngine<Rules>::isSingle(partner))
+            continue;   // already checked from the other side
+
+        bool hasPyramidCard = false;
+        for (int i = 0; i < countByValue[value]; i++) {
+            if (slotsByValue[value][i] < PYRAMID_CARDS)
+                hasPyramidCard = true;
+        }
+
+        if (partner < 1 || partner > 13 || PyramidEngine<Rules>::isSingle(partner)) {
+            if (hasPyramidCard)
+                return true;
+            continue;
+        }
+
+        if (partner == value) {
+            // Cards of this value pair among themselves; every pyramid copy
+            // needs some other copy it can meet
+            for (int i = 0; i < countByValue[value]; i++) {
+                int slot = slotsByValue[value][i];
+                if (slot >= PYRAMID_CARDS)
+                    continue;
+                bool paired = false;
+                for (int j = 0; j < countByValue[value] && !paired; j++) {
+                    paired = j != i && canMeet(slot, slotsByValue[value][j]);
+                }
+                if (!paired)
+                    return true;
+            }
+            continue;
+        }
+
+        if (!canPairAll(slotsByValue[value], countByValue[value],
+                        slotsByValue[partner], countByValue[partner], 0, 0))
+            return true;
+    }
+
+    return false;
+}
+
+#endif
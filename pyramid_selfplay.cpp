@@ -0,0 +1,261 @@
+// ============================================
+// SELF-PLAY TOURNAMENT
+// Plays the heuristic player over a fixed set of seeded deals for every
+// combination of weights in a grid, on every core, and reports win rate
+// and average score with 95% confidence intervals.
+//   g++ -O2 -std=c++17 -pthread pyramid_selfplay.cpp -o pyramid_selfplay
+//   ./pyramid_selfplay --deals 100000 --sweep uncover=0,1,2 --sweep king=-1,2
+// ============================================
+
+#include "pyramid_player.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+const int WEIGHT_COUNT = 6;
+const char* WEIGHT_NAMES[WEIGHT_COUNT] = {
+    "pyramid-pair", "waste-pair", "uncover", "depth", "king", "draw"
+};
+
+double& weightAt(PlayerWeights& w, int index) {
+    double* fields[WEIGHT_COUNT] = { &w.pyramidPair, &w.wastePair, &w.uncover, &w.depth, &w.king, &w.drawBias };
+    return *fields[index];
+}
+
+struct Sweep
+{
+    int weight;
+    vector<double> values;
+};
+
+struct TournamentOptions
+{
+    unsigned int firstSeed;
+    int dealCount;
+    int threads;
+    int maxMoves;
+    vector<Sweep> sweeps;
+};
+
+// Per configuration totals, added to by whichever thread plays a chunk
+struct ConfigResult
+{
+    atomic<long long> wins;
+    atomic<long long> scoreSum;
+    atomic<long long> scoreSquares;
+};
+
+// Wilson score interval, which stays sensible for win rates near 0 or 1
+void winInterval(long long wins, long long games, double& low, double& high) {
+    const double z = 1.96;
+    double p = (double)wins / games;
+    double denominator = 1.0 + z * z / games;
+    double centre = (p + z * z / (2.0 * games)) / denominator;
+    double spread = z * sqrt(p * (1.0 - p) / games + z * z / (4.0 * games * games)) / denominator;
+    low = centre - spread;
+    high = centre + spread;
+}
+
+// Every combination of the swept values, with unswept weights at their defaults
+void expandGrid(const vector<Sweep>& sweeps, vector<PlayerWeights>& configs) {
+    PlayerWeights base;
+    defaultWeights(base);
+    configs.assign(1, base);
+
+    for (size_t s = 0; s < sweeps.size(); s++) {
+        vector<PlayerWeights> grown;
+        for (size_t c = 0; c < configs.size(); c++) {
+            for (size_t v = 0; v < sweeps[s].values.size(); v++) {
+                PlayerWeights w = configs[c];
+                weightAt(w, sweeps[s].weight) = sweeps[s].values[v];
+                grown.push_back(w);
+            }
+        }
+        configs.swap(grown);
+    }
+}
+
+template<class Rules>
+int runTournament(const TournamentOptions& options) {
+    static const int CHUNK = 1024;
+
+    vector<Deal> deals(options.dealCount);
+    for (int i = 0; i < options.dealCount; i++) {
+        shuffleDeal(deals[i], options.firstSeed + (unsigned int)i);
+    }
+
+    vector<PlayerWeights> configs;
+    expandGrid(options.sweeps, configs);
+    vector<ConfigResult> results(configs.size());
+    for (size_t c = 0; c < results.size(); c++) {
+        results[c].wins = 0;
+        results[c].scoreSum = 0;
+        results[c].scoreSquares = 0;
+    }
+
+    // Work items are (configuration, chunk of deals), so all cores stay busy
+    // however the grid and the deal count compare
+    long long chunksPerConfig = (options.dealCount + CHUNK - 1) / CHUNK;
+    long long itemCount = chunksPerConfig * (long long)configs.size();
+    atomic<long long> nextItem(0);
+
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+    vector<thread> workers;
+    for (int t = 0; t < options.threads; t++) {
+        workers.push_back(thread([&] {
+            while (true) {
+                long long item = nextItem++;
+                if (item >= itemCount)
+                    return;
+
+                int config = (int)(item / chunksPerConfig);
+                int first = (int)(item % chunksPerConfig) * CHUNK;
+                int last = first + CHUNK < options.dealCount ? first + CHUNK : options.dealCount;
+
+                long long wins = 0;
+                long long scoreSum = 0;
+                long long scoreSquares = 0;
+                for (int d = first; d < last; d++) {
+                    GameState end = HeuristicPlayer<Rules>::playGame(deals[d], configs[config], options.maxMoves);
+                    if (end.won)
+                        wins++;
+                    scoreSum += end.score;
+                    scoreSquares += (long long)end.score * end.score;
+                }
+
+                results[config].wins += wins;
+                results[config].scoreSum += scoreSum;
+                results[config].scoreSquares += scoreSquares;
+            }
+        }));
+    }
+
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    long long games = options.dealCount;
+    size_t best = 0;
+    cout << fixed << setprecision(2);
+    for (size_t c = 0; c < configs.size(); c++) {
+        long long wins = results[c].wins;
+        double low, high;
+        winInterval(wins, games, low, high);
+
+        double mean = (double)results[c].scoreSum / games;
+        double variance = (double)results[c].scoreSquares / games - mean * mean;
+        double margin = 1.96 * sqrt(variance > 0 ? variance / games : 0.0);
+
+        for (int i = 0; i < WEIGHT_COUNT; i++) {
+            cout << WEIGHT_NAMES[i] << "=" << weightAt(configs[c], i) << " ";
+        }
+        cout << "win=" << 100.0 * wins / games << "% [" << 100.0 * low << ", " << 100.0 * high << "]"
+             << " score=" << mean << " +/- " << margin << endl;
+
+        if (wins > results[best].wins)
+            best = c;
+    }
+
+    cout << "configs=" << configs.size()
+         << " deals=" << games
+         << " games=" << games * (long long)configs.size()
+         << " best=" << best + 1
+         << " seconds=" << seconds << endl;
+    return 0;
+}
+
+// "name=v1,v2,..." into a sweep; false if the name or a value is not understood
+bool parseSweep(const string& text, Sweep& sweep) {
+    size_t equals = text.find('=');
+    if (equals == string::npos)
+        return false;
+
+    string name = text.substr(0, equals);
+    sweep.weight = -1;
+    for (int i = 0; i < WEIGHT_COUNT; i++) {
+        if (name == WEIGHT_NAMES[i])
+            sweep.weight = i;
+    }
+    if (sweep.weight < 0)
+        return false;
+
+    sweep.values.clear();
+    size_t start = equals + 1;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == string::npos)
+            comma = text.size();
+
+        string value = text.substr(start, comma - start);
+        char* end = nullptr;
+        double parsed = strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0')
+            return false;
+        sweep.values.push_back(parsed);
+        start = comma + 1;
+    }
+    return !sweep.values.empty();
+}
+
+int main(int argc, char** argv) {
+    TournamentOptions options;
+    options.firstSeed = 1;
+    options.dealCount = 100000;
+    options.threads = (int)thread::hardware_concurrency();
+    options.maxMoves = 2000;
+    string rules = "classic";
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        Sweep sweep;
+        if (arg == "--first" && i + 1 < argc)
+            options.firstSeed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--deals" && i + 1 < argc)
+            options.dealCount = atoi(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            options.threads = atoi(argv[++i]);
+        else if (arg == "--max-moves" && i + 1 < argc)
+            options.maxMoves = atoi(argv[++i]);
+        else if (arg == "--rules" && i + 1 < argc)
+            rules = argv[++i];
+        else if (arg == "--sweep" && i + 1 < argc && parseSweep(argv[i + 1], sweep)) {
+            options.sweeps.push_back(sweep);
+            i++;
+        }
+        else {
+            cerr << "usage: pyramid_selfplay [--first SEED] [--deals N] [--threads N] [--max-moves N]"
+                 << " [--rules classic|draw3|single-pass] [--sweep WEIGHT=V1,V2,...]..." << endl
+                 << "weights:";
+            for (int w = 0; w < WEIGHT_COUNT; w++) {
+                cerr << " " << WEIGHT_NAMES[w];
+            }
+            cerr << endl;
+            return 1;
+        }
+    }
+
+    if (options.threads < 1)
+        options.threads = 1;
+    if (options.dealCount < 1)
+        options.dealCount = 1;
+
+    if (rules == "classic")
+        return runTournament<ClassicRules>(options);
+    if (rules == "draw3")
+        return runTournament<DrawThreeRules>(options);
+    if (rules == "single-pass")
+        return runTournament<SinglePassRules>(options);
+
+    cerr << "unknown rules: " << rules << endl;
+    return 1;
+}
@@ -0,0 +1,649 @@
+// ============================================
+// MULTI-SESSION GAME SERVER
+// Hosts many independent games behind a line protocol on stdin/stdout or a
+// local Unix socket. With --tablebase, endgames are looked up so hopeless
+// games end as soon as they are lost. Build without raylib:
+//   g++ -O2 -std=c++17 -pthread pyramid_server.cpp -o pyramid_server
+// ============================================
+
+#include "pyramid_engine.h"
+#include "pyramid_tablebase.h"
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <climits>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+const int UNDO_DEPTH = 8;
+
+// Waste targets for "select", resolved by the worker that owns the session
+const int SELECT_WASTE = DECK_SIZE;
+const int SELECT_WASTE_SECOND = DECK_SIZE + 1;
+
+struct Connection;
+
+// One hosted game. Kept flat so sessions can live in a preallocated arena.
+struct Session
+{
+    Deal deal;
+    GameState state;
+    GameState undo[UNDO_DEPTH];
+    unsigned char undoCount;
+    unsigned char undoHead;
+    bool active;
+    int id;
+    unsigned int generation;    // bumped on release, so old ids stop matching
+    const Connection* owner;    // only the connection that opened it may use it
+    Session* nextFree;
+};
+
+// Fixed block of sessions with a free list; never touches the heap after startup
+class SessionArena {
+private:
+    Session* sessions;
+    Session* freeList;
+    int capacity;
+
+public:
+    SessionArena(int cap) {
+        capacity = cap;
+        sessions = new Session[capacity];
+        freeList = nullptr;
+        for (int i = capacity - 1; i >= 0; i--) {
+            sessions[i].active = false;
+            sessions[i].generation = 0;
+            sessions[i].owner = nullptr;
+            sessions[i].nextFree = freeList;
+            freeList = &sessions[i];
+        }
+    }
+
+    ~SessionArena() {
+        delete[] sessions;
+    }
+
+    Session* allocate() {
+        if (!freeList)
+            return nullptr;
+
+        Session* s = freeList;
+        freeList = s->nextFree;
+        s->active = true;
+        return s;
+    }
+
+    void release(Session* s) {
+        s->active = false;
+        s->generation++;
+        s->owner = nullptr;
+        s->nextFree = freeList;
+        freeList = s;
+    }
+
+    // Frees every session a connection opened, once it has gone away
+    void releaseOwnedBy(const Connection* owner) {
+        for (int i = 0; i < capacity; i++) {
+            if (sessions[i].active && sessions[i].owner == owner)
+                release(&sessions[i]);
+        }
+    }
+
+    int size() {
+        return capacity;
+    }
+
+    int indexOf(Session* s) {
+        return (int)(s - sessions);
+    }
+
+    Session* at(int index) {
+        if (index < 0 || index >= capacity || !sessions[index].active)
+            return nullptr;
+        return &sessions[index];
+    }
+};
+
+// Where replies for a command go. Shared by every queued command, and the
+// socket is only closed once the last of them is done with it, so its fd
+// number cannot be handed to a new client while replies are still pending.
+struct Connection
+{
+    int fd;
+    bool ownsFd;    // false for stdout, which is not ours to close
+    bool gone;      // the peer hung up; later replies are dropped
+    mutex writeLock;
+
+    Connection(int f, bool owns) {
+        fd = f;
+        ownsFd = owns;
+        gone = false;
+    }
+
+    ~Connection() {
+        if (ownsFd)
+            close(fd);
+    }
+
+    void send(const string& line) {
+        lock_guard<mutex> guard(writeLock);
+        const char* data = line.c_str();
+        size_t left = line.size();
+        while (left > 0 && !gone) {
+            ssize_t written = write(fd, data, left);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0) {
+                gone = true;
+                return;
+            }
+            data += written;
+            left -= written;
+        }
+    }
+};
+
+enum CommandType {
+    CMD_NEW,
+    CMD_DEAL,
+    CMD_SELECT,
+    CMD_DRAW,
+    CMD_UNDO,
+    CMD_STATE,
+    CMD_CLOSE,
+    CMD_DISCONNECT
+};
+
+struct Command
+{
+    CommandType type;
+    int session;
+    int slot;
+    unsigned int seed;
+    shared_ptr<Connection> conn;
+};
+
+// Each worker owns a shard of sessions (id % workerCount), so a session is
+// only ever touched by one thread and its commands stay in order
+template<class Rules>
+class Worker {
+private:
+    int index;
+    int workerCount;
+    int generationLimit;    // keeps ids within an int
+    SessionArena arena;
+    const Tablebase<Rules>* tablebase;
+    typedef PyramidEngine<Rules> Engine;
+    deque<Command> queue;
+    mutex queueLock;
+    condition_variable queueReady;
+    bool stopping;
+    thread runner;
+
+    // Ids are (generation, arena index, worker): the worker is id % workerCount
+    // so commands route without a lookup, and a reused slot gets a new id
+    int sessionId(Session* s) {
+        long long local = (long long)(s->generation % generationLimit) * arena.size() + arena.indexOf(s);
+        return (int)(local * workerCount + index);
+    }
+
+    // The session behind id if it is still open and belongs to conn
+    Session* find(int id, const Connection* conn) {
+        long long local = id / workerCount;
+        Session* s = arena.at((int)(local % arena.size()));
+        if (!s || s->generation % generationLimit != (unsigned int)(local / arena.size()) || s->owner != conn)
+            return nullptr;
+        return s;
+    }
+
+    void pushUndo(Session* s, const GameState& previous) {
+        s->undo[s->undoHead] = previous;
+        s->undoHead = (s->undoHead + 1) % UNDO_DEPTH;
+        if (s->undoCount < UNDO_DEPTH)
+            s->undoCount++;
+    }
+
+    // The engine only sees a loss once no move is left; the tablebase also
+    // knows when the remaining moves cannot lead anywhere
+    void checkLose(Session* s) {
+        Engine::checkLose(s->deal, s->state);
+        if (tablebase && !s->state.won && !s->state.lost
+            && tablebase->probe(s->deal, s->state) == SOLVE_LOSS)
+            s->state.lost = true;
+    }
+
+    string describe(Session* s) {
+        static const char* values[13] = { "A","2","3","4","5","6","7","8","9","10","J","Q","K" };
+        static const char* suits[4] = { "H", "D", "C", "S" };
+
+        GameState& st = s->state;
+        ostringstream out;
+        out << "ok " << s->id
+            << " score=" << st.score
+            << " moves=" << st.moves
+            << " passes=" << (int)st.passes
+            << " won=" << st.won
+            << " lost=" << st.lost;
+
+        int distance;
+        if (tablebase && !st.won && tablebase->probe(s->deal, st, &distance) == SOLVE_WIN)
+            out << " to_win=" << distance;
+
+        int waste = wasteTop(st);
+        out << " waste=";
+        if (waste == NO_SLOT)
+            out << "--";
+        else
+            out << values[cardValue(s->deal.cards[waste]) - 1] << suits[cardSuit(s->deal.cards[waste])];
+
+        if (Rules::WASTE_PAIRS) {
+            int second = wasteSecond(st);
+            out << " waste2=";
+            if (second == NO_SLOT)
+                out << "--";
+            else
+                out << values[cardValue(s->deal.cards[second]) - 1] << suits[cardSuit(s->deal.cards[second])];
+        }
+
+        out << " pyramid=";
+        for (int slot = 0; slot < PYRAMID_CARDS; slot++) {
+            if (slot > 0)
+                out << ",";
+            if (isRemoved(st, slot)) {
+                out << "--";
+                continue;
+            }
+            unsigned char c = s->deal.cards[slot];
+            out << values[cardValue(c) - 1] << suits[cardSuit(c)];
+            if (st.selected == slot)
+                out << "*";
+        }
+        out << "\n";
+        return out.str();
+    }
+
+    void execute(Command& cmd) {
+        if (cmd.type == CMD_NEW) {
+            Session* s = arena.allocate();
+            if (!s) {
+                cmd.conn->send("err - no free sessions\n");
+                return;
+            }
+            s->owner = cmd.conn.get();
+            s->id = sessionId(s);
+            s->undoCount = 0;
+            s->undoHead = 0;
+            shuffleDeal(s->deal, cmd.seed);
+            resetState(s->state);
+            cmd.conn->send(describe(s));
+            return;
+        }
+
+        // The connection is still referenced by this command, so no new
+        // connection can have its address while its sessions are freed
+        if (cmd.type == CMD_DISCONNECT) {
+            arena.releaseOwnedBy(cmd.conn.get());
+            return;
+        }
+
+        Session* s = find(cmd.session, cmd.conn.get());
+        if (!s) {
+            cmd.conn->send("err " + to_string(cmd.session) + " unknown session\n");
+            return;
+        }
+
+        switch (cmd.type) {
+        case CMD_DEAL:
+            s->undoCount = 0;
+            s->undoHead = 0;
+            shuffleDeal(s->deal, cmd.seed);
+            resetState(s->state);
+            break;
+
+        case CMD_SELECT: {
+            // Only this worker knows which cards the waste targets are
+            int slot = cmd.slot;
+            if (slot == SELECT_WASTE)
+                slot = wasteTop(s->state);
+            else if (slot == SELECT_WASTE_SECOND)
+                slot = wasteSecond(s->state);
+            GameState previous = s->state;
+            Engine::selectSlot(s->deal, s->state, slot);
+            checkLose(s);
+            if (memcmp(&previous, &s->state, sizeof(GameState)) != 0)
+                pushUndo(s, previous);
+            break;
+        }
+
+        case CMD_DRAW: {
+            GameState previous = s->state;
+            if (!Engine::drawFromStock(s->state)) {
+                cmd.conn->send("err " + to_string(s->id) + " stock is empty\n");
+                return;
+            }
+            checkLose(s);
+            pushUndo(s, previous);
+            break;
+        }
+
+        case CMD_UNDO:
+            if (s->undoCount == 0) {
+                cmd.conn->send("err " + to_string(s->id) + " nothing to undo\n");
+                return;
+            }
+            s->undoHead = (s->undoHead + UNDO_DEPTH - 1) % UNDO_DEPTH;
+            s->undoCount--;
+            s->state = s->undo[s->undoHead];
+            break;
+
+        case CMD_CLOSE:
+            arena.release(s);
+            cmd.conn->send("ok " + to_string(cmd.session) + " closed\n");
+            return;
+
+        default:
+            break;
+        }
+
+        cmd.conn->send(describe(s));
+    }
+
+    void run() {
+        while (true) {
+            Command cmd;
+            {
+                unique_lock<mutex> guard(queueLock);
+                queueReady.wait(guard, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                cmd = queue.front();
+                queue.pop_front();
+            }
+            execute(cmd);
+        }
+    }
+
+public:
+    Worker(int i, int count, int capacity, const Tablebase<Rules>* endgames) : arena(capacity) {
+        index = i;
+        workerCount = count;
+        generationLimit = (int)max(1LL, (long long)INT_MAX / ((long long)capacity * count));
+        tablebase = endgames;
+        stopping = false;
+        runner = thread(&Worker::run, this);
+    }
+
+    ~Worker() {
+        {
+            lock_guard<mutex> guard(queueLock);
+            stopping = true;
+        }
+        queueReady.notify_one();
+        runner.join();
+    }
+
+    void submit(const Command& cmd) {
+        {
+            lock_guard<mutex> guard(queueLock);
+            queue.push_back(cmd);
+        }
+        queueReady.notify_one();
+    }
+};
+
+template<class Rules>
+class GameServer {
+private:
+    vector<unique_ptr<Worker<Rules>>> workers;
+    mutex roundRobinLock;
+    int roundRobin;
+    unsigned int seedCounter;
+
+public:
+    GameServer(int workerCount, int sessionsPerWorker, const Tablebase<Rules>* tablebase) {
+        roundRobin = 0;
+        seedCounter = (unsigned int)time(nullptr);
+        for (int i = 0; i < workerCount; i++) {
+            workers.push_back(unique_ptr<Worker<Rules>>(new Worker<Rules>(i, workerCount, sessionsPerWorker, tablebase)));
+        }
+    }
+
+    // A client has gone: every worker frees the sessions it opened
+    void disconnect(shared_ptr<Connection> conn) {
+        Command cmd;
+        cmd.type = CMD_DISCONNECT;
+        cmd.session = -1;
+        cmd.slot = NO_SLOT;
+        cmd.seed = 0;
+        cmd.conn = conn;
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i]->submit(cmd);
+        }
+    }
+
+    // Parses one protocol line and hands it to the owning worker.
+    // Returns false on "quit".
+    bool handleLine(const string& line, shared_ptr<Connection> conn) {
+        istringstream in(line);
+        string word;
+        if (!(in >> word))
+            return true;
+
+        Command cmd;
+        cmd.conn = conn;
+        cmd.session = -1;
+        cmd.slot = NO_SLOT;
+        cmd.seed = 0;
+
+        if (word == "quit")
+            return false;
+
+        if (word == "new") {
+            cmd.type = CMD_NEW;
+            if (!(in >> cmd.seed)) {
+                lock_guard<mutex> guard(roundRobinLock);
+                cmd.seed = seedCounter++ * 2654435761u;
+            }
+            int target;
+            {
+                lock_guard<mutex> guard(roundRobinLock);
+                target = roundRobin;
+                roundRobin = (roundRobin + 1) % (int)workers.size();
+            }
+            workers[target]->submit(cmd);
+            return true;
+        }
+
+        if (!(in >> cmd.session) || cmd.session < 0) {
+            conn->send("err - expected session id\n");
+            return true;
+        }
+
+        if (word == "deal") {
+            cmd.type = CMD_DEAL;
+            if (!(in >> cmd.seed)) {
+                lock_guard<mutex> guard(roundRobinLock);
+                cmd.seed = seedCounter++ * 2654435761u;
+            }
+        }
+        else if (word == "select") {
+            cmd.type = CMD_SELECT;
+            string where;
+            int col;
+            if (!(in >> where)) {
+                conn->send("err " + to_string(cmd.session) + " expected <row> <col>, waste or waste2\n");
+                return true;
+            }
+            if (where == "waste") {
+                cmd.slot = SELECT_WASTE;
+            }
+            else if (where == "waste2") {
+                if (!Rules::WASTE_PAIRS) {
+                    conn->send("err " + to_string(cmd.session) + " waste2 needs --rules draw3\n");
+                    return true;
+                }
+                cmd.slot = SELECT_WASTE_SECOND;
+            }
+            else {
+                int row = atoi(where.c_str());
+                if (!(in >> col) || row < 0 || row >= PYRAMID_ROWS || col < 0 || col > row) {
+                    conn->send("err " + to_string(cmd.session) + " bad pyramid position\n");
+                    return true;
+                }
+                cmd.slot = pyramidSlot(row, col);
+            }
+        }
+        else if (word == "draw") {
+            cmd.type = CMD_DRAW;
+        }
+        else if (word == "undo") {
+            cmd.type = CMD_UNDO;
+        }
+        else if (word == "state") {
+            cmd.type = CMD_STATE;
+        }
+        else if (word == "close") {
+            cmd.type = CMD_CLOSE;
+        }
+        else {
+            conn->send("err " + to_string(cmd.session) + " unknown command\n");
+            return true;
+        }
+
+        workers[cmd.session % workers.size()]->submit(cmd);
+        return true;
+    }
+};
+
+template<class Rules>
+void serveStream(GameServer<Rules>& server, int inFd, shared_ptr<Connection> conn) {
+    string pending;
+    char buffer[4096];
+
+    while (true) {
+        ssize_t got = read(inFd, buffer, sizeof(buffer));
+        if (got <= 0)
+            return;
+
+        pending.append(buffer, got);
+        size_t start = 0;
+        size_t end;
+        while ((end = pending.find('\n', start)) != string::npos) {
+            if (!server.handleLine(pending.substr(start, end - start), conn))
+                return;
+            start = end + 1;
+        }
+        pending.erase(0, start);
+    }
+}
+
+template<class Rules>
+int serveSocket(GameServer<Rules>& server, const char* path) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        cerr << "socket() failed" << endl;
+        return 1;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 64) < 0) {
+        cerr << "cannot listen on " << path << endl;
+        close(listener);
+        return 1;
+    }
+
+    while (true) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+            continue;
+
+        thread([&server, client] {
+            shared_ptr<Connection> conn(new Connection(client, true));
+            serveStream(server, client, conn);
+            server.disconnect(conn);
+        }).detach();
+    }
+}
+
+template<class Rules>
+int runServer(int workerCount, int sessionsPerWorker, const char* socketPath, const char* tablebasePath) {
+    Tablebase<Rules> tablebase;
+    if (tablebasePath && !tablebase.load(tablebasePath)) {
+        cerr << "could not open tablebase " << tablebasePath << endl;
+        return 1;
+    }
+
+    GameServer<Rules> server(workerCount, sessionsPerWorker, tablebase.isOpen() ? &tablebase : nullptr);
+
+    if (socketPath)
+        return serveSocket(server, socketPath);
+
+    shared_ptr<Connection> out(new Connection(STDOUT_FILENO, false));
+    serveStream(server, STDIN_FILENO, out);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int workerCount = 4;
+    int sessionsPerWorker = 4096;
+    const char* socketPath = nullptr;
+    const char* tablebasePath = nullptr;
+    string rules = "classic";
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+            workerCount = atoi(argv[++i]);
+        else if (arg == "--sessions" && i + 1 < argc)
+            sessionsPerWorker = atoi(argv[++i]);
+        else if (arg == "--socket" && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (arg == "--rules" && i + 1 < argc)
+            rules = argv[++i];
+        else if (arg == "--tablebase" && i + 1 < argc)
+            tablebasePath = argv[++i];
+        else {
+            cerr << "usage: pyramid_server [--threads N] [--sessions N-per-thread] [--socket PATH]"
+                 << " [--rules classic|draw3|single-pass] [--tablebase FILE]" << endl;
+            return 1;
+        }
+    }
+
+    // A client that hangs up mid-reply must not take every other session with
+    // it; writes to it fail with EPIPE instead and the connection is dropped
+    signal(SIGPIPE, SIG_IGN);
+
+    if (workerCount < 1)
+        workerCount = 1;
+    if (sessionsPerWorker < 1)
+        sessionsPerWorker = 1;
+
+    if (rules == "classic")
+        return runServer<ClassicRules>(workerCount, sessionsPerWorker, socketPath, tablebasePath);
+    if (rules == "draw3")
+        return runServer<DrawThreeRules>(workerCount, sessionsPerWorker, socketPath, tablebasePath);
+    if (rules == "single-pass")
+        return runServer<SinglePassRules>(workerCount, sessionsPerWorker, socketPath, tablebasePath);
+
+    cerr << "unknown rules: " << rules << endl;
+    return 1;
+}
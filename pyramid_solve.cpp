@@ -0,0 +1,234 @@
+// ============================================
+// BATCH SOLVER
+// Solves a range of seeded deals on every core and reports how many are
+// winnable, or one hard deal (--deal) with every core working on it.
+// Proven results are kept in a cache file between runs, and an endgame
+// tablebase (see pyramid_tablebase.cpp) can settle the last few cards.
+//   g++ -O2 -std=c++17 -pthread pyramid_solve.cpp -o pyramid_solve
+// ============================================
+
+#include "pyramid_solver.h"
+#include "pyramid_precheck.h"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+struct BatchOptions
+{
+    bool singleDeal;
+    unsigned int firstSeed;
+    int count;
+    int threads;
+    long long nodeLimit;
+    string cachePath;
+    string tablebasePath;
+    bool verbose;
+};
+
+template<class Rules>
+bool loadTablebase(const BatchOptions& options, Tablebase<Rules>& tablebase) {
+    if (options.tablebasePath.empty())
+        return true;
+    if (!tablebase.load(options.tablebasePath)) {
+        cerr << "could not open tablebase " << options.tablebasePath << endl;
+        return false;
+    }
+    cerr << "tablebase covers the last " << tablebase.maxCards() << " cards" << endl;
+    return true;
+}
+
+template<class Rules>
+int runBatch(const BatchOptions& options) {
+    ResultCache<Rules> cache;
+    if (!options.cachePath.empty() && cache.load(options.cachePath))
+        cerr << "loaded " << cache.size() << " cached results" << endl;
+
+    Tablebase<Rules> tablebase;
+    if (!loadTablebase(options, tablebase))
+        return 1;
+    const Tablebase<Rules>* endgames = tablebase.isOpen() ? &tablebase : nullptr;
+
+    atomic<int> nextDeal(0);
+    atomic<int> wins(0);
+    atomic<int> losses(0);
+    atomic<int> unknown(0);
+    atomic<int> rejected(0);
+    atomic<long long> totalNodes(0);
+    atomic<long long> totalHits(0);
+    atomic<long long> totalProbes(0);
+    mutex printLock;
+
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+    vector<thread> workers;
+    for (int t = 0; t < options.threads; t++) {
+        workers.push_back(thread([&] {
+            while (true) {
+                int index = nextDeal++;
+                if (index >= options.count)
+                    return;
+
+                unsigned int seed = options.firstSeed + (unsigned int)index;
+                Deal deal;
+                shuffleDeal(deal, seed);
+                GameState start;
+                resetState(start);
+
+                Solver<Rules> solver(deal, &cache, endgames);
+                solver.nodeLimit = options.nodeLimit;
+                SolveResult result;
+                if (isStaticallyDead<Rules>(deal)) {
+                    rejected++;
+                    result = SOLVE_LOSS;
+                }
+                else {
+                    result = solver.solve(start);
+                }
+
+                totalNodes += solver.nodes;
+                totalHits += solver.cacheHits;
+                totalProbes += solver.tablebaseHits;
+                if (result == SOLVE_WIN)
+                    wins++;
+                else if (result == SOLVE_LOSS)
+                    losses++;
+                else
+                    unknown++;
+
+                if (options.verbose) {
+                    lock_guard<mutex> guard(printLock);
+                    const char* names[3] = { "unknown", "win", "loss" };
+                    cout << seed << " " << names[result] << " nodes=" << solver.nodes
+                         << " cache_hits=" << solver.cacheHits
+                         << " tablebase_hits=" << solver.tablebaseHits << endl;
+                }
+            }
+        }));
+    }
+
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    cout << "deals=" << options.count
+         << " wins=" << wins
+         << " losses=" << losses
+         << " unknown=" << unknown
+         << " prechecked=" << rejected
+         << " nodes=" << totalNodes
+         << " cache_hits=" << totalHits
+         << " tablebase_hits=" << totalProbes
+         << " seconds=" << seconds << endl;
+
+    if (!options.cachePath.empty() && !cache.save(options.cachePath)) {
+        cerr << "could not write " << options.cachePath << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Deals with shuffleDeal(), so slots follow the game's pyramid layout and stock order
+template<class Rules>
+int runSingleDeal(const BatchOptions& options) {
+    ResultCache<Rules> cache;
+    if (!options.cachePath.empty() && cache.load(options.cachePath))
+        cerr << "loaded " << cache.size() << " cached results" << endl;
+
+    Tablebase<Rules> tablebase;
+    if (!loadTablebase(options, tablebase))
+        return 1;
+
+    Deal deal;
+    shuffleDeal(deal, options.firstSeed);
+    GameState start;
+    resetState(start);
+
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    if (isStaticallyDead<Rules>(deal)) {
+        cout << options.firstSeed << " loss prechecked" << endl;
+        return 0;
+    }
+
+    ParallelSolver<Rules> solver(deal, &cache, options.nodeLimit,
+                                 tablebase.isOpen() ? &tablebase : nullptr);
+    SolveResult result = solver.solve(start, options.threads);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    const char* names[3] = { "unknown", "win", "loss" };
+    cout << options.firstSeed << " " << names[result]
+         << " nodes=" << solver.nodes
+         << " threads=" << options.threads
+         << " seconds=" << seconds << endl;
+
+    if (!options.cachePath.empty() && !cache.save(options.cachePath)) {
+        cerr << "could not write " << options.cachePath << endl;
+        return 1;
+    }
+    return 0;
+}
+
+template<class Rules>
+int run(const BatchOptions& options) {
+    if (options.singleDeal)
+        return runSingleDeal<Rules>(options);
+    return runBatch<Rules>(options);
+}
+
+int main(int argc, char** argv) {
+    BatchOptions options;
+    options.singleDeal = false;
+    options.firstSeed = 1;
+    options.count = 1000;
+    options.threads = (int)thread::hardware_concurrency();
+    options.nodeLimit = 5000000;
+    options.verbose = false;
+    string rules = "classic";
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--first" && i + 1 < argc)
+            options.firstSeed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--deal" && i + 1 < argc) {
+            options.singleDeal = true;
+            options.firstSeed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--count" && i + 1 < argc)
+            options.count = atoi(argv[++i]);
+        else if (arg == "--threads" && i + 1 < argc)
+            options.threads = atoi(argv[++i]);
+        else if (arg == "--node-limit" && i + 1 < argc)
+            options.nodeLimit = atoll(argv[++i]);
+        else if (arg == "--cache" && i + 1 < argc)
+            options.cachePath = argv[++i];
+        else if (arg == "--tablebase" && i + 1 < argc)
+            options.tablebasePath = argv[++i];
+        else if (arg == "--rules" && i + 1 < argc)
+            rules = argv[++i];
+        else if (arg == "-v")
+            options.verbose = true;
+        else {
+            cerr << "usage: pyramid_solve [--first SEED] [--count N] | [--deal SEED]"
+                 << " [--threads N] [--node-limit N]"
+                 << " [--cache FILE] [--tablebase FILE] [--rules classic|draw3|single-pass] [-v]" << endl;
+            return 1;
+        }
+    }
+
+    if (options.threads < 1)
+        options.threads = 1;
+
+    if (rules == "classic")
+        return run<ClassicRules>(options);
+    if (rules == "draw3")
+        return run<DrawThreeRules>(options);
+    if (rules == "single-pass")
+        return run<SinglePassRules>(options);
+
+    cerr << "unknown rules: " << rules << endl;
+    return 1;
+}
@@ -0,0 +1,673 @@
+#ifndef PYRAMID_SOLVER_H
+#define PYRAMID_SOLVER_H
+
+// ============================================
+// SOLVER
+// Depth-first search over engine positions, with a rank-only result cache
+// that is shared between deals and can be saved to disk.
+// ============================================
+
+#include "pyramid_engine.h"
+#include "pyramid_tablebase.h"
+#include <vector>
+#include <unordered_map>
+#include <climits>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Identifies a rules variant inside cache files
+template<class Rules>
+unsigned int rulesSignature() {
+    return (unsigned int)(Rules::PAIR_TARGET
+        | (Rules::SINGLE_VALUE << 6)
+        | (Rules::DRAW_COUNT << 12)
+        | ((Rules::RECYCLE_LIMIT + 1) << 16)
+        | ((Rules::WASTE_PAIRS ? 1 : 0) << 24));
+}
+
+// Exact position within one deal. Pass count only matters when recycles are limited.
+template<class Rules>
+unsigned long long stateKey(const GameState& st) {
+    unsigned long long key = st.removed | ((unsigned long long)st.stockCursor << DECK_SIZE);
+    if (Rules::RECYCLE_LIMIT >= 0)
+        key |= (unsigned long long)st.passes << (DECK_SIZE + 5);
+    return key;
+}
+
+// Rank-only position, equal for any two positions (of any deals) that play
+// out the same: isValidMove() and isKing() never look at suits.
+//   nibbles 0–27   pyramid values, 0 once removed
+//   nibbles 28–51  remaining stock values in draw order, 0 terminated
+//   last byte      remaining cards already drawn this pass, then passes
+struct PositionKey
+{
+    unsigned long long w[4];
+
+    bool operator==(const PositionKey& other) const {
+        return w[0] == other.w[0] && w[1] == other.w[1] && w[2] == other.w[2] && w[3] == other.w[3];
+    }
+};
+
+struct PositionKeyHash
+{
+    size_t operator()(const PositionKey& key) const {
+        unsigned long long h = key.w[0] * 0x9E3779B97F4A7C15ULL;
+        h ^= key.w[1] + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+        h ^= key.w[2] + 0x85157AF5ULL + (h << 6) + (h >> 2);
+        h ^= key.w[3] + (h << 6) + (h >> 2);
+        return (size_t)h;
+    }
+};
+
+template<class Rules>
+PositionKey canonicalKey(const Deal& deal, const GameState& st) {
+    PositionKey key;
+    memset(&key, 0, sizeof(key));
+
+    int nibble = 0;
+    for (int slot = 0; slot < PYRAMID_CARDS; slot++, nibble++) {
+        unsigned long long value = isRemoved(st, slot) ? 0 : cardValue(deal.cards[slot]);
+        key.w[nibble / 16] |= value << (4 * (nibble % 16));
+    }
+
+    int drawn = 0;
+    for (int i = 0; i < STOCK_SIZE; i++) {
+        int slot = PYRAMID_CARDS + i;
+        if (isRemoved(st, slot))
+            continue;
+        if (i < st.stockCursor)
+            drawn++;
+        key.w[nibble / 16] |= (unsigned long long)cardValue(deal.cards[slot]) << (4 * (nibble % 16));
+        nibble++;
+    }
+
+    unsigned long long tail = (unsigned long long)drawn;
+    if (Rules::RECYCLE_LIMIT >= 0)
+        tail |= (unsigned long long)st.passes << 5;
+    key.w[3] |= tail << 56;
+    return key;
+}
+
+inline int cardsInPlay(const GameState& st) {
+    return DECK_SIZE - __builtin_popcountll(st.removed);
+}
+
+// Proven results keyed by canonical position, shared by every solver thread.
+// Whole deals are kept apart from endgame positions: there is one per deal
+// solved, and they are what makes rerunning a batch free. Endgames are
+// capped at maxEntries, evicting at random once a shard is full.
+template<class Rules>
+class ResultCache {
+private:
+    static const int SHARDS = 64;
+    static const unsigned char ROOT_FLAG = 0x80;   // marks deal results in the file
+    // "PYR2": files from before waste singles stopped being pruned under
+    // grouped draws can hold false losses, so they no longer load
+    static const unsigned int FILE_MAGIC = 0x50595232;
+
+    typedef std::unordered_map<PositionKey, unsigned char, PositionKeyHash> ResultMap;
+
+    ResultMap shards[SHARDS];
+    std::mutex locks[SHARDS];
+    unsigned long long evictCursor[SHARDS];
+    ResultMap roots;
+    std::mutex rootLock;
+
+    int shardOf(const PositionKey& key) {
+        return (int)(PositionKeyHash()(key) >> 7) & (SHARDS - 1);
+    }
+
+    // Drops some entry of a full shard. Buckets are tried from a moving
+    // pseudo-random point; begin() alone would keep evicting the newest.
+    void evictOne(int shard) {
+        ResultMap& map = shards[shard];
+        for (int tries = 0; tries < 16; tries++) {
+            evictCursor[shard] = evictCursor[shard] * 6364136223846793005ULL + 1442695040888963407ULL;
+            size_t bucket = (size_t)(evictCursor[shard] >> 33) % map.bucket_count();
+            if (map.bucket_size(bucket) > 0) {
+                map.erase(map.begin(bucket)->first);
+                return;
+            }
+        }
+        map.erase(map.begin());
+    }
+
+public:
+    // Only positions this small are stored; they are the ones that recur across deals
+    int endgameCards;
+    long long maxEntries;   // endgame positions kept in memory and on disk
+
+    ResultCache() {
+        endgameCards = 16;
+        maxEntries = 1LL << 19;
+        for (int i = 0; i < SHARDS; i++) {
+            evictCursor[i] = (unsigned long long)i;
+        }
+    }
+
+    bool worthCaching(const GameState& st) {
+        return cardsInPlay(st) <= endgameCards;
+    }
+
+    SolveResult lookup(const PositionKey& key) {
+        int shard = shardOf(key);
+        std::lock_guard<std::mutex> guard(locks[shard]);
+        ResultMap::iterator it = shards[shard].find(key);
+        if (it == shards[shard].end())
+            return SOLVE_UNKNOWN;
+        return (SolveResult)it->second;
+    }
+
+    void store(const PositionKey& key, SolveResult result) {
+        int shard = shardOf(key);
+        std::lock_guard<std::mutex> guard(locks[shard]);
+        ResultMap& map = shards[shard];
+        long long shardLimit = maxEntries / SHARDS > 0 ? maxEntries / SHARDS : 1;
+        if ((long long)map.size() >= shardLimit && map.find(key) == map.end())
+            evictOne(shard);
+        map[key] = (unsigned char)result;
+    }
+
+    SolveResult lookupDeal(const PositionKey& key) {
+        std::lock_guard<std::mutex> guard(rootLock);
+        ResultMap::iterator it = roots.find(key);
+        if (it == roots.end())
+            return SOLVE_UNKNOWN;
+        return (SolveResult)it->second;
+    }
+
+    void storeDeal(const PositionKey& key, SolveResult result) {
+        std::lock_guard<std::mutex> guard(rootLock);
+        roots[key] = (unsigned char)result;
+    }
+
+    long long size() {
+        long long total = 0;
+        for (int i = 0; i < SHARDS; i++) {
+            std::lock_guard<std::mutex> guard(locks[i]);
+            total += (long long)shards[i].size();
+        }
+        std::lock_guard<std::mutex> guard(rootLock);
+        return total + (long long)roots.size();
+    }
+
+    // A missing or mismatched file just leaves the cache empty. Entries go
+    // through store(), so a file saved with a larger cap is cut down to this one.
+    bool load(const std::string& path) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+
+        unsigned int header[2];
+        if (fread(header, sizeof(header), 1, file) != 1 || header[0] != FILE_MAGIC
+            || header[1] != rulesSignature<Rules>()) {
+            fclose(file);
+            return false;
+        }
+
+        PositionKey key;
+        unsigned char result;
+        while (fread(&key, sizeof(key), 1, file) == 1 && fread(&result, 1, 1, file) == 1) {
+            if (result & ROOT_FLAG)
+                storeDeal(key, (SolveResult)(result & ~ROOT_FLAG));
+            else
+                store(key, (SolveResult)result);
+        }
+        fclose(file);
+        return true;
+    }
+
+    // Written to a temporary file first so a crash never leaves a torn cache
+    bool save(const std::string& path) {
+        std::string temp = path + ".tmp";
+        FILE* file = fopen(temp.c_str(), "wb");
+        if (!file)
+            return false;
+
+        unsigned int header[2] = { FILE_MAGIC, rulesSignature<Rules>() };
+        bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+
+        for (int i = 0; i < SHARDS && ok; i++) {
+            std::lock_guard<std::mutex> guard(locks[i]);
+            ResultMap::iterator it;
+            for (it = shards[i].begin(); it != shards[i].end() && ok; ++it) {
+                ok = fwrite(&it->first, sizeof(PositionKey), 1, file) == 1
+                    && fwrite(&it->second, 1, 1, file) == 1;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(rootLock);
+        ResultMap::iterator it;
+        for (it = roots.begin(); it != roots.end() && ok; ++it) {
+            unsigned char flagged = it->second | ROOT_FLAG;
+            ok = fwrite(&it->first, sizeof(PositionKey), 1, file) == 1
+                && fwrite(&flagged, 1, 1, file) == 1;
+        }
+
+        if (fclose(file) != 0)
+            ok = false;
+        if (!ok) {
+            remove(temp.c_str());
+            return false;
+        }
+        return rename(temp.c_str(), path.c_str()) == 0;
+    }
+};
+
+// Solves one deal on the calling thread
+template<class Rules = ClassicRules>
+class Solver {
+private:
+
+    const Deal& deal;
+    ResultCache<Rules>* cache;
+    const Tablebase<Rules>* tablebase;
+    std::unordered_map<unsigned long long, int> visited;   // exact key -> search index, -1 if cached
+    std::vector<bool> onStack;
+    std::vector<GameState> open;                           // positions whose group is not finished yet
+    bool aborted;
+
+    // Depth-first search with Tarjan-style bookkeeping: once a strongly
+    // connected group of positions is fully explored without a win, every
+    // position in it is a proven loss, even if the deal as a whole is not
+    // decided. low is the earliest still-open position this one can reach.
+    bool tryChild(const GameState& child, int& low) {
+        if (child.won)
+            return true;
+
+        int childLow = INT_MAX;
+        if (search(child, childLow))
+            return true;
+
+        if (childLow < low)
+            low = childLow;
+        return false;
+    }
+
+    bool search(const GameState& st, int& low) {
+        if (aborted)
+            return false;
+
+        unsigned long long exact = stateKey<Rules>(st);
+        std::unordered_map<unsigned long long, int>::iterator seen = visited.find(exact);
+        if (seen != visited.end()) {
+            if (seen->second >= 0 && onStack[seen->second])
+                low = seen->second;
+            return false;
+        }
+
+        nodes++;
+        if (nodeLimit > 0 && nodes > nodeLimit) {
+            aborted = true;
+            return false;
+        }
+
+        if (tablebase) {
+            SolveResult known = tablebase->probe(deal, st);
+            if (known != SOLVE_UNKNOWN) {
+                tablebaseHits++;
+                visited[exact] = -1;
+                return known == SOLVE_WIN;
+            }
+        }
+
+        bool cacheable = cache && cache->worthCaching(st);
+        PositionKey key;
+        if (cacheable) {
+            key = canonicalKey<Rules>(deal, st);
+            SolveResult known = cache->lookup(key);
+            if (known != SOLVE_UNKNOWN) {
+                cacheHits++;
+                visited[exact] = -1;
+                return known == SOLVE_WIN;
+            }
+        }
+
+        int index = (int)onStack.size();
+        visited[exact] = index;
+        onStack.push_back(true);
+        open.push_back(st);
+        low = index;
+
+        if (expand(st, low)) {
+            if (cacheable)
+                cache->store(key, SOLVE_WIN);
+            return true;
+        }
+
+        if (aborted || low != index)
+            return false;
+
+        // This position closes a finished group: all of it is lost
+        while (true) {
+            GameState member = open.back();
+            open.pop_back();
+            int memberIndex = visited[stateKey<Rules>(member)];
+            onStack[memberIndex] = false;
+            if (cache && cache->worthCaching(member))
+                cache->store(canonicalKey<Rules>(deal, member), SOLVE_LOSS);
+            if (memberIndex == index)
+                break;
+        }
+        low = INT_MAX;
+        return false;
+    }
+
+    bool expand(const GameState& st, int& low) {
+        GameState children[MAX_CHILDREN];
+        int count = childPositions<Rules>(deal, st, children, pruneSingles);
+
+        for (int i = 0; i < count; i++) {
+            if (tryChild(children[i], low))
+                return true;
+        }
+        return false;
+    }
+
+public:
+    long long nodes;
+    long long nodeLimit;    // 0 for no limit
+    long long cacheHits;
+    long long tablebaseHits;
+    bool pruneSingles;      // off only to check the shortcut against a full search
+
+    Solver(const Deal& d, ResultCache<Rules>* sharedCache, const Tablebase<Rules>* endgames = nullptr) : deal(d) {
+        cache = sharedCache;
+        tablebase = endgames;
+        aborted = false;
+        nodes = 0;
+        nodeLimit = 0;
+        cacheHits = 0;
+        tablebaseHits = 0;
+        pruneSingles = true;
+    }
+
+    SolveResult solve(const GameState& start) {
+        visited.clear();
+        onStack.clear();
+        open.clear();
+        aborted = false;
+        nodes = 0;
+        cacheHits = 0;
+        tablebaseHits = 0;
+
+        if (start.won)
+            return SOLVE_WIN;
+
+        // Whole deals are cached whatever their size, so rerunning a batch is free
+        PositionKey rootKey = canonicalKey<Rules>(deal, start);
+        if (cache) {
+            SolveResult known = cache->lookupDeal(rootKey);
+            if (known != SOLVE_UNKNOWN) {
+                cacheHits++;
+                return known;
+            }
+        }
+
+        int low = INT_MAX;
+        if (search(start, low)) {
+            if (cache)
+                cache->storeDeal(rootKey, SOLVE_WIN);
+            return SOLVE_WIN;
+        }
+
+        if (aborted)
+            return SOLVE_UNKNOWN;
+
+        if (cache)
+            cache->storeDeal(rootKey, SOLVE_LOSS);
+        return SOLVE_LOSS;
+    }
+};
+
+// Visited set shared by every thread of a parallel solve. Open addressing
+// over atomic words: a position belongs to whichever thread swaps it in first.
+class ConcurrentVisitedTable {
+private:
+    static const int MAX_PROBES = 512;
+
+    std::unique_ptr<std::atomic<unsigned long long>[]> slots;
+    unsigned long long capacity;
+    unsigned long long mask;
+
+public:
+    enum ClaimResult {
+        CLAIMED,
+        ALREADY_SEEN,
+        TABLE_FULL
+    };
+
+    ConcurrentVisitedTable() {
+        capacity = 0;
+        mask = 0;
+    }
+
+    // Empties the table, growing it first if it holds fewer than minEntries
+    void reset(long long minEntries) {
+        unsigned long long wanted = 1024;
+        while ((long long)wanted < minEntries)
+            wanted <<= 1;
+
+        if (wanted > capacity) {
+            slots.reset(new std::atomic<unsigned long long>[wanted]);
+            capacity = wanted;
+            mask = capacity - 1;
+        }
+        for (unsigned long long i = 0; i < capacity; i++) {
+            slots[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ClaimResult claim(unsigned long long key) {
+        unsigned long long stored = key + 1;   // 0 marks an empty slot
+        unsigned long long index = (stored * 0x9E3779B97F4A7C15ULL) >> 20;
+
+        for (int probe = 0; probe < MAX_PROBES; probe++, index++) {
+            std::atomic<unsigned long long>& slot = slots[index & mask];
+            unsigned long long current = slot.load(std::memory_order_relaxed);
+            if (current == 0 && slot.compare_exchange_strong(current, stored, std::memory_order_relaxed))
+                return CLAIMED;
+            if (current == stored)
+                return ALREADY_SEEN;
+        }
+        return TABLE_FULL;
+    }
+};
+
+// Solves one deal on several threads. The first few levels of the tree are
+// expanded breadth-first into a shared work list; threads then take items
+// from it and search depth-first, sharing one visited table so no position
+// is explored twice. The first thread to reach a win stops the others.
+template<class Rules = ClassicRules>
+class ParallelSolver {
+private:
+    static const int ITEMS_PER_THREAD = 64;
+    static const int NODE_BATCH = 4096;
+
+    const Deal& deal;
+    ResultCache<Rules>* cache;
+    const Tablebase<Rules>* tablebase;
+    ConcurrentVisitedTable table;
+    std::vector<GameState> frontier;
+    std::atomic<size_t> nextItem;
+    std::atomic<bool> found;
+    std::atomic<bool> aborted;
+    std::atomic<long long> nodeCount;
+
+    bool stopped() {
+        return found.load(std::memory_order_relaxed) || aborted.load(std::memory_order_relaxed);
+    }
+
+    bool search(const GameState& st, long long& localNodes) {
+        if (stopped())
+            return false;
+
+        ConcurrentVisitedTable::ClaimResult claim = table.claim(stateKey<Rules>(st));
+        if (claim == ConcurrentVisitedTable::ALREADY_SEEN)
+            return false;
+        if (claim == ConcurrentVisitedTable::TABLE_FULL) {
+            aborted = true;
+            return false;
+        }
+        return explore(st, localNodes);
+    }
+
+    // st has already been claimed by this thread
+    bool explore(const GameState& st, long long& localNodes) {
+        if (++localNodes == NODE_BATCH) {
+            long long total = nodeCount.fetch_add(localNodes) + localNodes;
+            localNodes = 0;
+            if (nodeLimit > 0 && total > nodeLimit) {
+                aborted = true;
+                return false;
+            }
+        }
+
+        if (tablebase) {
+            SolveResult known = tablebase->probe(deal, st);
+            if (known != SOLVE_UNKNOWN)
+                return known == SOLVE_WIN;
+        }
+
+        bool cacheable = cache && cache->worthCaching(st);
+        PositionKey key;
+        if (cacheable) {
+            key = canonicalKey<Rules>(deal, st);
+            SolveResult known = cache->lookup(key);
+            if (known != SOLVE_UNKNOWN)
+                return known == SOLVE_WIN;
+        }
+
+        GameState children[MAX_CHILDREN];
+        int count = childPositions<Rules>(deal, st, children);
+        for (int i = 0; i < count; i++) {
+            if (children[i].won || search(children[i], localNodes)) {
+                if (cacheable)
+                    cache->store(key, SOLVE_WIN);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker() {
+        long long localNodes = 0;
+        while (!stopped()) {
+            size_t item = nextItem++;
+            if (item >= frontier.size())
+                break;
+            if (explore(frontier[item], localNodes))
+                found = true;
+        }
+        nodeCount += localNodes;
+    }
+
+    // Breadth-first expansion until there is enough work to share out.
+    // Returns SOLVE_WIN or SOLVE_LOSS if that already decides the deal; a
+    // full table or the node limit sets aborted, and the result is unknown.
+    SolveResult buildFrontier(const GameState& start, int threads) {
+        std::vector<GameState> level(1, start);
+        table.claim(stateKey<Rules>(start));
+
+        while (level.size() < (size_t)threads * ITEMS_PER_THREAD) {
+            std::vector<GameState> next;
+            GameState children[MAX_CHILDREN];
+
+            for (size_t i = 0; i < level.size(); i++) {
+                int count = childPositions<Rules>(deal, level[i], children);
+                for (int c = 0; c < count; c++) {
+                    if (children[c].won)
+                        return SOLVE_WIN;
+                    // A dropped child would turn into a false loss below
+                    ConcurrentVisitedTable::ClaimResult claim = table.claim(stateKey<Rules>(children[c]));
+                    if (claim == ConcurrentVisitedTable::TABLE_FULL) {
+                        aborted = true;
+                        return SOLVE_UNKNOWN;
+                    }
+                    if (claim == ConcurrentVisitedTable::CLAIMED)
+                        next.push_back(children[c]);
+                }
+            }
+
+            nodeCount += (long long)level.size();
+            if (nodeLimit > 0 && nodeCount > nodeLimit) {
+                aborted = true;
+                return SOLVE_UNKNOWN;
+            }
+            if (next.empty())
+                return SOLVE_LOSS;
+            level.swap(next);
+        }
+
+        frontier.swap(level);
+        return SOLVE_UNKNOWN;
+    }
+
+public:
+    long long nodes;
+    long long nodeLimit;    // 0 for no limit
+
+    // The visited table is sized from nodeLimit, so set the limit here
+    // rather than afterwards
+    ParallelSolver(const Deal& d, ResultCache<Rules>* sharedCache, long long limit,
+                   const Tablebase<Rules>* endgames = nullptr)
+        : deal(d) {
+        cache = sharedCache;
+        tablebase = endgames;
+        nodeLimit = limit;
+        nodes = 0;
+    }
+
+    SolveResult solve(const GameState& start, int threads) {
+        if (start.won)
+            return SOLVE_WIN;
+
+        PositionKey rootKey = canonicalKey<Rules>(deal, start);
+        if (cache) {
+            SolveResult known = cache->lookupDeal(rootKey);
+            if (known != SOLVE_UNKNOWN)
+                return known;
+        }
+
+        nextItem = 0;
+        found = false;
+        aborted = false;
+        nodeCount = 0;
+        frontier.clear();
+
+        // Room for the search itself plus the frontier: every level short of
+        // the target, and the children of the last one
+        long long frontierEntries = (long long)threads * ITEMS_PER_THREAD * (MAX_CHILDREN + 1);
+        table.reset((nodeLimit > 0 ? nodeLimit * 2 : (1LL << 26)) + frontierEntries);
+
+        SolveResult result = buildFrontier(start, threads);
+        if (result == SOLVE_UNKNOWN && !aborted) {
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++) {
+                workers.push_back(std::thread(&ParallelSolver::worker, this));
+            }
+            for (size_t t = 0; t < workers.size(); t++) {
+                workers[t].join();
+            }
+
+            if (found)
+                result = SOLVE_WIN;
+            else if (!aborted)
+                result = SOLVE_LOSS;
+        }
+
+        // An aborted run stopped short of the whole tree, so nothing it
+        // concluded goes into the persistent cache
+        nodes = nodeCount;
+        if (cache && result != SOLVE_UNKNOWN && !aborted)
+            cache->storeDeal(rootKey, result);
+        return result;
+    }
+};
+
+#endif
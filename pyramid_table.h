@@ -0,0 +1,386 @@
+#ifndef PYRAMID_TABLE_H
+#define PYRAMID_TABLE_H
+
+// ============================================
+// LAYOUT-GENERIC ENGINE
+// The rules of pyramid_engine.h for any row count and any number of decks.
+// PyramidEngine keeps the classic 7-row, one-deck game in 24 bytes for the
+// solver and tablebase. This engine sizes its storage from the layout and
+// keeps the free cards up to date as cards go, so a removal, a lose check
+// and a draw cost the same however big the table is.
+// The rules themselves (clicks, draws, whether a move is left) are called
+// from PyramidEngine; pyramid_check.cpp plays both engines side by side.
+// ============================================
+
+#include "pyramid_engine.h"
+
+template<int ROWS, int DECKS>
+struct PyramidLayout
+{
+    static const int ROW_COUNT = ROWS;
+    static const int DECK_COUNT = DECKS;
+    static const int PYRAMID = ROWS * (ROWS + 1) / 2;
+    static const int CARDS = 52 * DECKS;
+    static const int STOCK = CARDS - PYRAMID;
+    static const int WORDS = (CARDS + 63) / 64;
+
+    static_assert(ROWS >= 1 && DECKS >= 1, "a table needs at least one row and one deck");
+    static_assert(PYRAMID <= CARDS, "the pyramid needs more cards than the decks hold");
+    static_assert(CARDS <= 32767, "slots must fit in a short");
+};
+
+typedef PyramidLayout<PYRAMID_ROWS, 1> ClassicLayout;
+typedef PyramidLayout<14, 4> BigTableLayout;
+
+static_assert(ClassicLayout::PYRAMID == PYRAMID_CARDS && ClassicLayout::CARDS == DECK_SIZE,
+              "ClassicLayout must match the compact engine");
+
+// Same slot order as Deal: pyramid rows from the top, then the stock in draw order
+template<class Layout>
+struct TableDeal
+{
+    unsigned char cards[Layout::CARDS];
+};
+
+template<class Layout>
+void shuffleTable(TableDeal<Layout>& deal, unsigned int seed) {
+    if (seed == 0)
+        seed = 0x9E3779B9u;
+
+    int index = 0;
+    for (int deck = 0; deck < Layout::DECK_COUNT; deck++) {
+        for (int suit = 0; suit < 4; suit++) {
+            for (int value = 1; value <= 13; value++) {
+                deal.cards[index++] = packCard(value, suit);
+            }
+        }
+    }
+
+    for (int i = Layout::CARDS - 1; i > 0; i--) {
+        int j = nextRandom(seed) % (i + 1);
+        unsigned char temp = deal.cards[i];
+        deal.cards[i] = deal.cards[j];
+        deal.cards[j] = temp;
+    }
+}
+
+// Row of each pyramid slot, built once per layout
+template<class Layout>
+struct RowTable
+{
+    unsigned short rows[Layout::PYRAMID];
+
+    RowTable() {
+        for (int row = 0; row < Layout::ROW_COUNT; row++) {
+            for (int col = 0; col <= row; col++) {
+                rows[pyramidSlot(row, col)] = (unsigned short)row;
+            }
+        }
+    }
+};
+
+template<class Layout>
+int tableRow(int slot) {
+    static const RowTable<Layout> table;
+    return table.rows[slot];
+}
+
+template<class Layout>
+struct TableState
+{
+    unsigned long long removed[Layout::WORDS];
+    unsigned long long free[Layout::WORDS];   // pyramid slots with nothing left on top
+    unsigned short freeByValue[14];           // free pyramid cards of each value
+    int score;
+    int moves;
+    short pyramidLeft;
+    short stockLeft;                          // stock cards still in play
+    short stockAhead;                         // of those, the ones not drawn this pass
+    short stockCursor;                        // stock cards before this one have been drawn this pass
+    short selected;                           // NO_SLOT when nothing is selected
+    unsigned char passes;
+    bool won;
+    bool lost;
+};
+
+// One whole move: a single, a pair, or a draw (slot1 == NO_SLOT)
+struct TableMove
+{
+    short slot1;
+    short slot2;    // NO_SLOT for a single
+};
+
+template<class Rules, class Layout>
+class TableEngine {
+private:
+    typedef TableState<Layout> State;
+    typedef TableDeal<Layout> TDeal;
+    typedef PyramidEngine<Rules> Engine;   // the rules themselves live there
+
+    static bool bit(const unsigned long long* words, int slot) {
+        return (words[slot >> 6] >> (slot & 63)) & 1ULL;
+    }
+
+    static void setBit(unsigned long long* words, int slot) {
+        words[slot >> 6] |= 1ULL << (slot & 63);
+    }
+
+    static void clearBit(unsigned long long* words, int slot) {
+        words[slot >> 6] &= ~(1ULL << (slot & 63));
+    }
+
+    // First stock card in play at or after index, STOCK if none
+    static int nextInStock(const State& st, int index) {
+        int slot = Layout::PYRAMID + index;
+        while (slot < Layout::CARDS) {
+            unsigned long long open = ~st.removed[slot >> 6] & (~0ULL << (slot & 63));
+            if (open) {
+                int found = (slot & ~63) + __builtin_ctzll(open);
+                return found < Layout::CARDS ? found - Layout::PYRAMID : Layout::STOCK;
+            }
+            slot = (slot & ~63) + 64;
+        }
+        return Layout::STOCK;
+    }
+
+    // Last stock card in play before index, -1 if none
+    static int previousInStock(const State& st, int index) {
+        int slot = Layout::PYRAMID + index - 1;
+        while (slot >= Layout::PYRAMID) {
+            unsigned long long below = (slot & 63) == 63 ? ~0ULL : (2ULL << (slot & 63)) - 1;
+            unsigned long long open = ~st.removed[slot >> 6] & below;
+            if (open) {
+                int found = (slot & ~63) + 63 - __builtin_clzll(open);
+                return found >= Layout::PYRAMID ? found - Layout::PYRAMID : -1;
+            }
+            slot = (slot & ~63) - 1;
+        }
+        return -1;
+    }
+
+    static void markFree(const TDeal& deal, State& st, int slot) {
+        setBit(st.free, slot);
+        st.freeByValue[cardValue(deal.cards[slot])]++;
+    }
+
+    // Takes a card out of play and frees whatever it was the last cover of.
+    // Only the two cards resting on it can change, so this is constant time.
+    static void removeSlot(const TDeal& deal, State& st, int slot) {
+        setBit(st.removed, slot);
+
+        if (slot >= Layout::PYRAMID) {
+            st.stockLeft--;
+            return;
+        }
+
+        clearBit(st.free, slot);
+        st.freeByValue[cardValue(deal.cards[slot])]--;
+        st.pyramidLeft--;
+
+        int row = tableRow<Layout>(slot);
+        if (row == 0)
+            return;
+
+        int col = slot - pyramidSlot(row, 0);
+        if (col > 0) {
+            int parent = pyramidSlot(row - 1, col - 1);
+            if (bit(st.removed, slot - 1))
+                markFree(deal, st, parent);
+        }
+        if (col < row) {
+            int parent = pyramidSlot(row - 1, col);
+            if (bit(st.removed, slot + 1))
+                markFree(deal, st, parent);
+        }
+    }
+
+public:
+    static void reset(const TDeal& deal, State& st) {
+        for (int w = 0; w < Layout::WORDS; w++) {
+            st.removed[w] = 0;
+            st.free[w] = 0;
+        }
+        for (int v = 0; v < 14; v++) {
+            st.freeByValue[v] = 0;
+        }
+
+        int bottom = pyramidSlot(Layout::ROW_COUNT - 1, 0);
+        for (int slot = bottom; slot < Layout::PYRAMID; slot++) {
+            markFree(deal, st, slot);
+        }
+
+        st.score = 0;
+        st.moves = 0;
+        st.pyramidLeft = (short)Layout::PYRAMID;
+        st.stockLeft = (short)Layout::STOCK;
+        st.stockAhead = (short)Layout::STOCK;
+        st.stockCursor = 0;
+        st.selected = NO_SLOT;
+        st.passes = 0;
+        st.won = false;
+        st.lost = false;
+    }
+
+    static bool isRemoved(const State& st, int slot) {
+        return bit(st.removed, slot);
+    }
+
+    static int wasteTop(const State& st) {
+        int index = previousInStock(st, st.stockCursor);
+        return index < 0 ? NO_SLOT : Layout::PYRAMID + index;
+    }
+
+    static int wasteSecond(const State& st) {
+        int top = wasteTop(st);
+        if (top == NO_SLOT)
+            return NO_SLOT;
+        int index = previousInStock(st, top - Layout::PYRAMID);
+        return index < 0 ? NO_SLOT : Layout::PYRAMID + index;
+    }
+
+    static bool isSlotFree(const State& st, int slot) {
+        if (slot < 0 || slot >= Layout::CARDS)
+            return false;
+        if (slot < Layout::PYRAMID)
+            return bit(st.free, slot);
+        if (bit(st.removed, slot))
+            return false;
+        if (slot == wasteTop(st))
+            return true;
+        return Rules::WASTE_PAIRS && slot == wasteSecond(st);
+    }
+
+    static bool stockHasCards(const State& st) {
+        return st.stockAhead > 0 || (Engine::canRecycle(st) && st.stockLeft > 0);
+    }
+
+    static void checkWin(State& st) {
+        if (st.pyramidLeft == 0)
+            st.won = true;
+    }
+
+    // Works on free cards counted by value, so it costs the same at any size
+    static void checkLose(const TDeal& deal, State& st) {
+        if (stockHasCards(st))
+            return;
+
+        int counts[14];
+        for (int v = 0; v < 14; v++) {
+            counts[v] = st.freeByValue[v];
+        }
+
+        int waste = wasteTop(st);
+        if (waste != NO_SLOT)
+            counts[cardValue(deal.cards[waste])]++;
+        if (Rules::WASTE_PAIRS) {
+            int second = wasteSecond(st);
+            if (second != NO_SLOT)
+                counts[cardValue(deal.cards[second])]++;
+        }
+
+        if (!Engine::hasMove(counts))
+            st.lost = true;
+    }
+
+    static bool drawFromStock(State& st) {
+        int next = nextInStock(st, st.stockCursor);
+
+        if (next == Layout::STOCK) {
+            if (!Engine::canRecycle(st) || st.stockLeft == 0)
+                return false;
+            st.passes++;
+            st.stockAhead = st.stockLeft;
+            next = nextInStock(st, 0);
+        }
+
+        int drawn;
+        int end = Engine::drawEnd(next, Layout::STOCK, [&st](int index) {
+            return nextInStock(st, index);
+        }, drawn);
+
+        st.stockCursor = (short)end;
+        st.stockAhead = (short)(st.stockAhead - drawn);
+        st.selected = NO_SLOT;
+        st.moves++;
+        return true;
+    }
+
+    static void selectSlot(const TDeal& deal, State& st, int slot) {
+        if (st.won || st.lost || !isSlotFree(st, slot))
+            return;
+
+        if (Engine::click(deal, st, slot, [&deal, &st](int taken) { removeSlot(deal, st, taken); }))
+            checkWin(st);
+    }
+
+    // Every whole move available, up to maxMoves. Only the free cards are
+    // visited, found a word at a time from the free mask.
+    static int listMoves(const TDeal& deal, const State& st, TableMove* moves, int maxMoves) {
+        short byValue[14][Layout::ROW_COUNT + 2];
+        int counts[14] = { 0 };
+
+        for (int w = 0; w < Layout::WORDS; w++) {
+            unsigned long long bits = st.free[w];
+            while (bits) {
+                int slot = w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                int value = cardValue(deal.cards[slot]);
+                byValue[value][counts[value]++] = (short)slot;
+            }
+        }
+
+        int waste = wasteTop(st);
+        if (waste != NO_SLOT) {
+            int value = cardValue(deal.cards[waste]);
+            byValue[value][counts[value]++] = (short)waste;
+        }
+        if (Rules::WASTE_PAIRS) {
+            int second = wasteSecond(st);
+            if (second != NO_SLOT) {
+                int value = cardValue(deal.cards[second]);
+                byValue[value][counts[value]++] = (short)second;
+            }
+        }
+
+        int made = 0;
+        for (int v = 1; v <= 13 && made < maxMoves; v++) {
+            if (Engine::isSingle(v)) {
+                for (int i = 0; i < counts[v] && made < maxMoves; i++) {
+                    moves[made].slot1 = byValue[v][i];
+                    moves[made++].slot2 = NO_SLOT;
+                }
+                continue;
+            }
+
+            int partner = Rules::PAIR_TARGET - v;
+            if (partner < v || partner > 13 || Engine::isSingle(partner))
+                continue;
+
+            for (int i = 0; i < counts[v]; i++) {
+                for (int j = partner == v ? i + 1 : 0; j < counts[partner] && made < maxMoves; j++) {
+                    moves[made].slot1 = byValue[v][i];
+                    moves[made++].slot2 = byValue[partner][j];
+                }
+            }
+        }
+
+        if (made < maxMoves && stockHasCards(st)) {
+            moves[made].slot1 = NO_SLOT;
+            moves[made++].slot2 = NO_SLOT;
+        }
+        return made;
+    }
+
+    static void playMove(const TDeal& deal, State& st, const TableMove& move) {
+        if (move.slot1 == NO_SLOT) {
+            drawFromStock(st);
+            return;
+        }
+        st.selected = NO_SLOT;
+        selectSlot(deal, st, move.slot1);
+        if (move.slot2 != NO_SLOT)
+            selectSlot(deal, st, move.slot2);
+    }
+};
+
+#endif
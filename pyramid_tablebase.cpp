@@ -0,0 +1,70 @@
+// ============================================
+// TABLEBASE GENERATOR
+// Writes the endgame tablebase used by pyramid_solve and pyramid_server.
+// Rerunning on an unfinished file resumes where it stopped.
+//   g++ -O2 -std=c++17 pyramid_tablebase.cpp -o pyramid_tablebase
+//   ./pyramid_tablebase endgames.tb --cards 5
+// ============================================
+
+#include "pyramid_tablebase.h"
+#include <iostream>
+#include <string>
+#include <chrono>
+
+using namespace std;
+
+// 13^cards positions per shape, so each extra card costs about 20x
+const int MAX_TABLEBASE_CARDS = 6;
+
+template<class Rules>
+int build(const string& path, int cards, bool verbose) {
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+
+    Tablebase<Rules> tablebase;
+    if (!tablebase.generate(path, cards, verbose)) {
+        cerr << "could not build " << path << endl;
+        return 1;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    cout << path << ": last " << tablebase.maxCards() << " cards, seconds=" << seconds << endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    string path;
+    string rules = "classic";
+    int cards = 5;
+    bool verbose = false;
+    bool usage = false;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--cards" && i + 1 < argc)
+            cards = atoi(argv[++i]);
+        else if (arg == "--rules" && i + 1 < argc)
+            rules = argv[++i];
+        else if (arg == "-v")
+            verbose = true;
+        else if (path.empty() && arg[0] != '-')
+            path = arg;
+        else
+            usage = true;
+    }
+
+    if (usage || path.empty() || cards < 1 || cards > MAX_TABLEBASE_CARDS) {
+        cerr << "usage: pyramid_tablebase FILE [--cards 1-" << MAX_TABLEBASE_CARDS << "]"
+             << " [--rules classic|draw3|single-pass] [-v]" << endl;
+        return 1;
+    }
+
+    if (rules == "classic")
+        return build<ClassicRules>(path, cards, verbose);
+    if (rules == "draw3")
+        return build<DrawThreeRules>(path, cards, verbose);
+    if (rules == "single-pass")
+        return build<SinglePassRules>(path, cards, verbose);
+
+    cerr << "unknown rules: " << rules << endl;
+    return 1;
+}
@@ -0,0 +1,460 @@
+#ifndef PYRAMID_TABLEBASE_H
+#define PYRAMID_TABLEBASE_H
+
+// ============================================
+// ENDGAME TABLEBASE
+// Win/loss and distance to win for every rank-only position with at most
+// maxCards cards left (pyramid plus stock), generated offline into one file
+// that is memory-mapped for probing.
+//
+// Index: positions are grouped into blocks by (pyramid shape, stock size).
+// Within a block the index is mixed radix over the pyramid values in slot
+// order, the stock values in draw order, how many stock cards have been
+// drawn this pass and, for limited recycles, the pass count. Every
+// position has exactly one slot, so the hash is perfect.
+//
+// Entry byte: 0 not generated yet, 1 loss, 2 + n win in n moves.
+// ============================================
+
+#include "pyramid_engine.h"
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum SolveResult {
+    SOLVE_UNKNOWN,
+    SOLVE_WIN,
+    SOLVE_LOSS
+};
+
+const unsigned char TB_UNKNOWN = 0;
+const unsigned char TB_LOSS = 1;
+const unsigned char TB_WIN_BASE = 2;
+const int TB_MAX_DISTANCE = 253;
+
+struct TablebaseHeader
+{
+    unsigned int magic;
+    unsigned int rules;
+    int maxCards;
+    int blockCount;
+    int completedBlocks;     // blocks before this one are final; generation resumes here
+    int reserved;
+    long long entries;
+    char padding[32];
+};
+
+// One (shape, stock size) group of positions
+struct TablebaseBlock
+{
+    unsigned int shape;      // pyramid slots still in play
+    int pyramidCards;
+    int stockCards;
+    long long offset;        // first entry of the block
+    long long size;
+};
+
+template<class Rules>
+class Tablebase {
+private:
+    static const unsigned int FILE_MAGIC = 0x50595442;  // "PYTB"
+
+    int fd;
+    unsigned char* mapped;
+    size_t mappedBytes;
+    TablebaseHeader* header;
+    unsigned char* entries;
+
+    std::vector<TablebaseBlock> blocks;
+    std::vector<long long> powers;
+
+    static int passStates() {
+        return Rules::RECYCLE_LIMIT < 0 ? 1 : Rules::RECYCLE_LIMIT + 1;
+    }
+
+    static unsigned int signature() {
+        return (unsigned int)(Rules::PAIR_TARGET
+            | (Rules::SINGLE_VALUE << 6)
+            | (Rules::DRAW_COUNT << 12)
+            | ((Rules::RECYCLE_LIMIT + 1) << 16)
+            | ((Rules::WASTE_PAIRS ? 1 : 0) << 24));
+    }
+
+    // Pyramid shapes in play near the end: a card can only still be there if
+    // every card it covers is too, so shapes grow down from the apex
+    static void collectShapes(int maxCards, std::vector<unsigned int>& shapes) {
+        shapes.clear();
+        shapes.push_back(0);
+
+        for (size_t i = 0; i < shapes.size(); i++) {
+            unsigned int shape = shapes[i];
+            if (__builtin_popcount(shape) >= maxCards)
+                continue;
+
+            for (int slot = 0; slot < PYRAMID_CARDS; slot++) {
+                if ((shape >> slot) & 1)
+                    continue;
+
+                int row = slotRow(slot);
+                int col = slot - pyramidSlot(row, 0);
+                bool supported = true;
+                if (row > 0 && col > 0 && !((shape >> pyramidSlot(row - 1, col - 1)) & 1))
+                    supported = false;
+                if (row > 0 && col < row && !((shape >> pyramidSlot(row - 1, col)) & 1))
+                    supported = false;
+                if (!supported)
+                    continue;
+
+                unsigned int grown = shape | (1u << slot);
+                bool known = false;
+                for (size_t j = 0; j < shapes.size() && !known; j++) {
+                    known = shapes[j] == grown;
+                }
+                if (!known)
+                    shapes.push_back(grown);
+            }
+        }
+    }
+
+    void buildLayout(int maxCards) {
+        powers.assign(2 * maxCards + 1, 1);
+        for (size_t i = 1; i < powers.size(); i++) {
+            powers[i] = powers[i - 1] * 13;
+        }
+
+        std::vector<unsigned int> shapes;
+        collectShapes(maxCards, shapes);
+
+        // Fewer cards first, so removals always lead into finished blocks
+        blocks.clear();
+        long long offset = 0;
+        for (int total = 0; total <= maxCards; total++) {
+            for (size_t i = 0; i < shapes.size(); i++) {
+                int pyramidCards = __builtin_popcount(shapes[i]);
+                if (pyramidCards > total)
+                    continue;
+
+                TablebaseBlock block;
+                block.shape = shapes[i];
+                block.pyramidCards = pyramidCards;
+                block.stockCards = total - pyramidCards;
+                block.offset = offset;
+                block.size = powers[total] * (block.stockCards + 1) * passStates();
+                blocks.push_back(block);
+                offset += block.size;
+            }
+        }
+    }
+
+    int findBlock(unsigned int shape, int stockCards) const {
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (blocks[i].shape == shape && blocks[i].stockCards == stockCards)
+                return (int)i;
+        }
+        return -1;
+    }
+
+    // Rebuilds the position at index within block b as a deal and state
+    void decode(int b, long long index, Deal& deal, GameState& st) const {
+        const TablebaseBlock& block = blocks[b];
+        int passes = (int)(index % passStates());
+        index /= passStates();
+        int drawn = (int)(index % (block.stockCards + 1));
+        index /= block.stockCards + 1;
+
+        memset(&deal, 0, sizeof(deal));
+        resetState(st);
+        st.removed = ~0ULL >> (64 - DECK_SIZE);
+
+        for (int i = block.stockCards - 1; i >= 0; i--) {
+            int slot = PYRAMID_CARDS + i;
+            deal.cards[slot] = packCard((int)(index % 13) + 1, 0);
+            index /= 13;
+            st.removed &= ~(1ULL << slot);
+        }
+
+        for (int slot = PYRAMID_CARDS - 1; slot >= 0; slot--) {
+            if (!((block.shape >> slot) & 1))
+                continue;
+            deal.cards[slot] = packCard((int)(index % 13) + 1, 0);
+            index /= 13;
+            st.removed &= ~(1ULL << slot);
+        }
+
+        st.stockCursor = (unsigned char)drawn;
+        st.passes = (unsigned char)passes;
+        st.won = block.pyramidCards == 0;
+    }
+
+    bool openFile(const std::string& path, bool writable) {
+        fd = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(TablebaseHeader)) {
+            closeFile();
+            return false;
+        }
+
+        mappedBytes = (size_t)info.st_size;
+        void* data = mmap(nullptr, mappedBytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            mapped = nullptr;
+            closeFile();
+            return false;
+        }
+
+        mapped = (unsigned char*)data;
+        header = (TablebaseHeader*)mapped;
+        entries = mapped + sizeof(TablebaseHeader);
+
+        if (header->magic != FILE_MAGIC || header->rules != signature()) {
+            closeFile();
+            return false;
+        }
+
+        buildLayout(header->maxCards);
+        if ((long long)mappedBytes < (long long)sizeof(TablebaseHeader) + header->entries
+            || header->blockCount != (int)blocks.size()) {
+            closeFile();
+            return false;
+        }
+        return true;
+    }
+
+    void closeFile() {
+        if (mapped)
+            munmap(mapped, mappedBytes);
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+        mapped = nullptr;
+        header = nullptr;
+        entries = nullptr;
+    }
+
+    void generateBlock(int b) {
+        const TablebaseBlock& block = blocks[b];
+        int groupSize = (block.stockCards + 1) * passStates();
+        long long groups = block.size / groupSize;
+        std::vector<int> distance(groupSize);
+        std::vector<int> drawTarget(groupSize);
+
+        for (long long group = 0; group < groups; group++) {
+            long long first = group * groupSize;
+
+            // Best removal for every cursor position of this set of cards...
+            for (int i = 0; i < groupSize; i++) {
+                Deal deal;
+                GameState st;
+                decode(b, first + i, deal, st);
+                distance[i] = st.won ? 0 : -1;
+                drawTarget[i] = -1;
+                if (st.won)
+                    continue;
+
+                GameState children[MAX_CHILDREN];
+                int count = childPositions<Rules>(deal, st, children, false);
+                for (int c = 0; c < count; c++) {
+                    int childDistance;
+                    if (children[c].won) {
+                        childDistance = 0;
+                    }
+                    else if (__builtin_popcountll(children[c].removed) == __builtin_popcountll(st.removed)) {
+                        // A draw keeps the same cards, so it lands in this group
+                        drawTarget[i] = (int)(indexOf(deal, children[c]) - block.offset - first);
+                        continue;
+                    }
+                    else {
+                        unsigned char known = TB_UNKNOWN;
+                        long long index = indexOf(deal, children[c]);
+                        if (index >= 0)
+                            known = entries[index];
+                        if (known < TB_WIN_BASE)
+                            continue;
+                        childDistance = known - TB_WIN_BASE;
+                    }
+
+                    if (distance[i] < 0 || childDistance + 1 < distance[i])
+                        distance[i] = childDistance + 1;
+                }
+            }
+
+            // ...then let draws carry wins around the stock until nothing improves
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (int i = 0; i < groupSize; i++) {
+                    int target = drawTarget[i];
+                    if (target < 0 || distance[target] < 0)
+                        continue;
+                    if (distance[i] < 0 || distance[target] + 1 < distance[i]) {
+                        distance[i] = distance[target] + 1;
+                        changed = true;
+                    }
+                }
+            }
+
+            for (int i = 0; i < groupSize; i++) {
+                unsigned char value = TB_LOSS;
+                if (distance[i] >= 0)
+                    value = (unsigned char)(TB_WIN_BASE + (distance[i] < TB_MAX_DISTANCE ? distance[i] : TB_MAX_DISTANCE));
+                entries[block.offset + first + i] = value;
+            }
+        }
+    }
+
+public:
+    Tablebase() {
+        fd = -1;
+        mapped = nullptr;
+        mappedBytes = 0;
+        header = nullptr;
+        entries = nullptr;
+    }
+
+    ~Tablebase() {
+        closeFile();
+    }
+
+    bool isOpen() const {
+        return entries != nullptr;
+    }
+
+    int maxCards() const {
+        return header ? header->maxCards : 0;
+    }
+
+    // Maps an existing, fully generated file for probing
+    bool load(const std::string& path) {
+        closeFile();
+        if (!openFile(path, false))
+            return false;
+        if (header->completedBlocks != header->blockCount) {
+            closeFile();
+            return false;
+        }
+        return true;
+    }
+
+    // Index of a position, or -1 when it has too many cards to be covered
+    long long indexOf(const Deal& deal, const GameState& st) const {
+        unsigned int shape = (unsigned int)(~st.removed & ((1ULL << PYRAMID_CARDS) - 1));
+        int stockCards = 0;
+        int drawn = 0;
+        for (int i = 0; i < STOCK_SIZE; i++) {
+            if (isRemoved(st, PYRAMID_CARDS + i))
+                continue;
+            stockCards++;
+            if (i < st.stockCursor)
+                drawn++;
+        }
+
+        if (__builtin_popcount(shape) + stockCards > header->maxCards)
+            return -1;
+
+        int b = findBlock(shape, stockCards);
+        if (b < 0)
+            return -1;
+
+        long long index = 0;
+        for (int slot = 0; slot < PYRAMID_CARDS; slot++) {
+            if ((shape >> slot) & 1)
+                index = index * 13 + cardValue(deal.cards[slot]) - 1;
+        }
+        for (int i = 0; i < STOCK_SIZE; i++) {
+            int slot = PYRAMID_CARDS + i;
+            if (!isRemoved(st, slot))
+                index = index * 13 + cardValue(deal.cards[slot]) - 1;
+        }
+        index = index * (stockCards + 1) + drawn;
+        index = index * passStates() + (Rules::RECYCLE_LIMIT < 0 ? 0 : st.passes);
+
+        return blocks[b].offset + index;
+    }
+
+    // SOLVE_UNKNOWN when the position is outside the table
+    SolveResult probe(const Deal& deal, const GameState& st, int* distance = nullptr) const {
+        if (!entries)
+            return SOLVE_UNKNOWN;
+
+        long long index = indexOf(deal, st);
+        if (index < 0)
+            return SOLVE_UNKNOWN;
+
+        unsigned char value = entries[index];
+        if (value == TB_LOSS)
+            return SOLVE_LOSS;
+        if (value < TB_WIN_BASE)
+            return SOLVE_UNKNOWN;
+
+        if (distance)
+            *distance = value - TB_WIN_BASE;
+        return SOLVE_WIN;
+    }
+
+    // Creates or resumes a tablebase file. Each finished block is flushed and
+    // recorded in the header, so an interrupted build picks up where it stopped.
+    bool generate(const std::string& path, int cards, bool verbose) {
+        closeFile();
+
+        if (!openFile(path, true)) {
+            closeFile();
+
+            // Only a missing file is created; anything else at the path may be
+            // a finished tablebase for other rules, so it is never overwritten
+            struct stat existing;
+            if (stat(path.c_str(), &existing) == 0) {
+                fprintf(stderr, "%s exists but is not a tablebase for these rules; not overwriting it\n", path.c_str());
+                return false;
+            }
+
+            buildLayout(cards);
+            long long total = blocks.back().offset + blocks.back().size;
+            int created = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+            if (created < 0)
+                return false;
+
+            TablebaseHeader fresh;
+            memset(&fresh, 0, sizeof(fresh));
+            fresh.magic = FILE_MAGIC;
+            fresh.rules = signature();
+            fresh.maxCards = cards;
+            fresh.blockCount = (int)blocks.size();
+            fresh.completedBlocks = 0;
+            fresh.entries = total;
+
+            bool ok = ftruncate(created, (off_t)(sizeof(TablebaseHeader) + total)) == 0
+                && pwrite(created, &fresh, sizeof(fresh), 0) == (ssize_t)sizeof(fresh);
+            close(created);
+            if (!ok || !openFile(path, true))
+                return false;
+        }
+        else if (header->maxCards != cards) {
+            fprintf(stderr, "%s was started with %d cards; resuming with that\n", path.c_str(), header->maxCards);
+        }
+
+        for (int b = header->completedBlocks; b < header->blockCount; b++) {
+            generateBlock(b);
+            msync(mapped, mappedBytes, MS_SYNC);
+            header->completedBlocks = b + 1;
+            msync(mapped, sizeof(TablebaseHeader), MS_SYNC);
+
+            if (verbose) {
+                fprintf(stderr, "block %d/%d: %d pyramid + %d stock cards, %lld positions\n",
+                    b + 1, header->blockCount, blocks[b].pyramidCards, blocks[b].stockCards, blocks[b].size);
+            }
+        }
+
+        closeFile();
+        return load(path);
+    }
+};
+
+#endif
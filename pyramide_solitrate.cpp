@@ -1,13 +1,51 @@
 #include "raylib.h"
+#include "pyramid_engine.h"
 #include <iostream>
 #include <ctime>
 #include <fstream>
 #include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 using namespace std;
 
-// Game State Enum
-enum GameState {
+#ifdef TRACK_ALLOCATIONS
+// Build with -DTRACK_ALLOCATIONS to count heap allocations per frame and per game.
+// After startup the play loop is expected to report none; --check-allocations
+// plays scripted games without a window and exits non-zero if it does not.
+atomic<long long> allocationCount(0);
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#endif
+
+// Which screen is showing
+enum ScreenState {
     MAIN_MENU,
     INSTRUCTIONS,
     PLAYING,
@@ -60,27 +98,58 @@ public:
 };
 
 // Linked List class
+// Removed nodes go to a spare list and are reused, so once reserve() has
+// been called a list of bounded size never touches the heap again.
 template<typename T>
 class LinkedList {
 private:
     ListNode<T>* head;
     ListNode<T>* tail;
+    ListNode<T>* spare;
     int size;
 
+    ListNode<T>* makeNode(T data) {
+        if (!spare)
+            return new ListNode<T>(data);
+
+        ListNode<T>* node = spare;
+        spare = spare->next;
+        node->data = data;
+        node->next = NULL;
+        return node;
+    }
+
+    void releaseNode(ListNode<T>* node) {
+        node->next = spare;
+        spare = node;
+    }
+
 public:
     LinkedList()
     {
         head = NULL;
         tail = NULL;
+        spare = NULL;
         size = 0;
     }
 
     ~LinkedList() {
         clear();
+        while (spare) {
+            ListNode<T>* temp = spare;
+            spare = spare->next;
+            delete temp;
+        }
+    }
+
+    void reserve(int count) {
+        for (int i = 0; i < count; i++) {
+            releaseNode(new ListNode<T>(T()));
+        }
     }
 
     void pushBack(T data) {
-        ListNode<T>* newNode = new ListNode<T>(data);
+        ListNode<T>* newNode = makeNode(data);
         if (!head) {
             head = tail = newNode;
         }
@@ -92,7 +161,7 @@ public:
     }
 
     void pushFront(T data) {
-        ListNode<T>* newNode = new ListNode<T>(data);
+        ListNode<T>* newNode = makeNode(data);
         if (!head) {
             head = tail = newNode;
         }
@@ -109,7 +178,7 @@ public:
 
         if (head == tail) {
             T data = head->data;
-            delete head;
+            releaseNode(head);
             head = tail = nullptr;
             size--;
             return data;
@@ -121,7 +190,7 @@ public:
         }
 
         T data = tail->data;
-        delete tail;
+        releaseNode(tail);
         tail = current;
         tail->next = nullptr;
         size--;
@@ -135,7 +204,7 @@ public:
         T data = head->data;
         ListNode<T>* temp = head;
         head = head->next;
-        delete temp;
+        releaseNode(temp);
         size--;
 
         if (!head)
@@ -170,7 +239,7 @@ public:
         while (head) {
             ListNode<T>* temp = head;
             head = head->next;
-            delete temp;
+            releaseNode(temp);
         }
 
         tail = nullptr;
@@ -196,7 +265,7 @@ public:
                 ListNode<T>* temp = current->next;
                 current->next = temp->next;
                 if (temp == tail) tail = current;
-                delete temp;
+                releaseNode(temp);
                 size--;
                 return;
             }
@@ -205,564 +274,840 @@ public:
     }
 };
 
-// Pyramid Node (from previous team member)
-class PyramidNode
-{
+// Single-producer/single-consumer ring buffer.
+// The render thread pushes, the simulation thread pops, neither side locks.
+template<typename T, int N>
+class SpscQueue {
+private:
+    T items[N];
+    atomic<int> head;   // next slot to read
+    atomic<int> tail;   // next slot to write
+
 public:
-    Card* card;
-    PyramidNode* left;
-    PyramidNode* right;
-    PyramidNode* nextInRow;
-    int row;
-    int col;
-    bool blocked;
-
-    PyramidNode(Card* c, int r, int cl)
-    {
-        card = c;
-        left = NULL;
-        right = NULL;
-        nextInRow = NULL;
-        row = r;
-        col = cl;
-        blocked = true;
+    SpscQueue() {
+        head = 0;
+        tail = 0;
+    }
+
+    bool push(const T& item) {
+        int t = tail.load(memory_order_relaxed);
+        int next = (t + 1) % N;
+        if (next == head.load(memory_order_acquire))
+            return false;
+
+        items[t] = item;
+        tail.store(next, memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        int h = head.load(memory_order_relaxed);
+        if (h == tail.load(memory_order_acquire))
+            return false;
+
+        item = items[h];
+        head.store((h + 1) % N, memory_order_release);
+        return true;
     }
 };
 
-// Game class
-class PyramidSolitaire {
+// Triple buffer: the writer always has a private buffer, the reader always
+// sees the most recently published one, and nobody waits
+template<typename T>
+class SnapshotBuffer {
 private:
-    // MY CONTRIBUTION: Card Flow Data Members
-    LinkedList<Card> deck;
-    LinkedList<Card*> stock;
-    LinkedList<Card*> stockBackup;
-    LinkedList<Card*> wasteHistory;
-    Card* currentWasteCard;
-    Card allCards[52];
-    int cardCount;
-    int stockPosition;
-    int moves;
-
-    // Previous team member's data
-    PyramidNode* pyramidRows[7];
-    Card* selectedCard1;
-    Card* selectedCard2;
-    PyramidNode* selectedNode1;
-    PyramidNode* selectedNode2;
-
-    int score;
-    float gameTime;
-    bool gameWon;
-    bool gameLost;
-
-    Texture2D stockTexture;
-    Texture2D background;
-    Texture2D cardTextures[4][13];
+    static const int FRESH = 4;
 
-    GameState state;
+    T buffers[3];
+    atomic<int> latest;   // index of the last published buffer, FRESH if unread
+    int writing;
+    int reading;
 
-    const int CARD_WIDTH = 90;
-    const int CARD_HEIGHT = 130;
-    const int CARD_SPACING = 20;
+public:
+    SnapshotBuffer() {
+        writing = 0;
+        latest = 1;
+        reading = 2;
+    }
 
-    Rectangle stockRect;
+    T& beginWrite() {
+        return buffers[writing];
+    }
 
-public:
-    PyramidSolitaire() {
-        for (int i = 0; i < 7; i++) {
-            pyramidRows[i] = nullptr;
-        }
-
-        selectedCard1 = nullptr;
-        selectedCard2 = nullptr;
-        selectedNode1 = nullptr;
-        selectedNode2 = nullptr;
-        currentWasteCard = nullptr;
-        score = 0;
-        moves = 0;
-        gameTime = 0.0f;
-        gameWon = false;
-        gameLost = false;
-        cardCount = 0;
-        stockPosition = 0;
-        state = MAIN_MENU;
+    void publish() {
+        writing = latest.exchange(writing | FRESH) & 3;
+    }
 
-        loadCardTextures();
-        stockRect = { 0, 0, 0, 0 };
+    const T& read() {
+        if (latest.load(memory_order_acquire) & FRESH)
+            reading = latest.exchange(reading) & 3;
+        return buffers[reading];
     }
+};
 
-    ~PyramidSolitaire() {
-        for (int s = 0; s < 4; s++) {
-            for (int v = 0; v < 13; v++) {
-                UnloadTexture(cardTextures[s][v]);
+// ============================================
+// EVENT TRACE
+// Every move is recorded as a fixed 16-byte record in an append-only file,
+// for analytics. The game thread only stamps the time and pushes into a
+// lock-free ring; a background thread does the file writes.
+// File format: a flat array of TraceEvent in native byte order. Each run
+// starts with a TRACE_SESSION record whose time is wall-clock nanoseconds
+// since the Unix epoch; later times are nanoseconds since that record.
+// ============================================
+
+enum TraceEventType {
+    TRACE_SESSION,
+    TRACE_NEW_GAME,
+    TRACE_SELECT,         // first card of a pair picked
+    TRACE_UNSELECT,       // same card clicked again
+    TRACE_KING,
+    TRACE_PAIR,           // both cards from the pyramid
+    TRACE_WASTE_PAIR,     // one card from the waste
+    TRACE_MISMATCH,       // second card did not make 13
+    TRACE_DRAW,
+    TRACE_RECYCLE,        // stock turned over, then drawn from
+    TRACE_WIN,
+    TRACE_LOSS
+};
+
+struct TraceEvent
+{
+    long long time;
+    unsigned char type;
+    signed char slot1;      // NO_SLOT when unused
+    signed char slot2;
+    unsigned char passes;
+    short scoreDelta;
+    short moves;            // move count after the event
+};
+
+static_assert(sizeof(TraceEvent) == 16, "trace files rely on 16-byte records");
+
+class EventTrace {
+private:
+    static const int RING_SIZE = 4096;
+    static const int FLUSH_MS = 100;
+
+    SpscQueue<TraceEvent, RING_SIZE> ring;
+    chrono::steady_clock::time_point sessionStart;
+    FILE* file;
+    thread flusher;
+    atomic<bool> running;
+
+    void flushLoop() {
+        TraceEvent batch[256];
+        while (true) {
+            bool stopping = !running;
+
+            int count = 0;
+            TraceEvent ev;
+            while (ring.pop(ev)) {
+                batch[count++] = ev;
+                if (count == 256) {
+                    fwrite(batch, sizeof(TraceEvent), count, file);
+                    count = 0;
+                }
             }
+            if (count > 0)
+                fwrite(batch, sizeof(TraceEvent), count, file);
+            fflush(file);
+
+            if (stopping)
+                return;
+            this_thread::sleep_for(chrono::milliseconds(FLUSH_MS));
         }
-        UnloadTexture(background);
-        UnloadTexture(stockTexture);
-        clearPyramid();
     }
 
-    void loadCardTextures() {
+public:
+    EventTrace() {
+        file = nullptr;
+        running = false;
+    }
+
+    ~EventTrace() {
+        stop();
+    }
+
+    bool start(const char* path) {
+        file = fopen(path, "ab");
+        if (!file)
+            return false;
+
+        sessionStart = chrono::steady_clock::now();
+        TraceEvent session = { 0, TRACE_SESSION, NO_SLOT, NO_SLOT, 0, 0, 0 };
+        session.time = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        ring.push(session);
+
+        running = true;
+        flusher = thread(&EventTrace::flushLoop, this);
+        return true;
+    }
+
+    void stop() {
+        running = false;
+        if (flusher.joinable())
+            flusher.join();
+        if (file)
+            fclose(file);
+        file = nullptr;
+    }
+
+    // Game thread only. A full ring drops the event rather than wait.
+    void record(TraceEventType type, int slot1, int slot2, const GameState& before, const GameState& after) {
+        if (!file)
+            return;
+
+        TraceEvent ev;
+        ev.time = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - sessionStart).count();
+        ev.type = (unsigned char)type;
+        ev.slot1 = (signed char)slot1;
+        ev.slot2 = (signed char)slot2;
+        ev.passes = after.passes;
+        ev.scoreDelta = (short)(after.score - before.score);
+        ev.moves = (short)after.moves;
+        ring.push(ev);
+    }
+};
+
+// ============================================
+// CARD ART CACHE
+// Decoding and resizing 53 JPEGs is most of the start-up time, so the
+// finished atlas is kept as raw pixels in images/cards.cache. Later
+// launches map that file and upload it to the GPU as it is. Every source
+// is stamped with its modification time, size and hash. A changed time
+// alone (a fresh checkout, say) only costs a rehash, and only changed
+// contents force a rebuild.
+// ============================================
+
+const int ATLAS_COLUMNS = 13;
+const int ATLAS_CELLS = 53;        // 52 faces in suit order, then the stock back
+const int STOCK_CELL = 52;
+
+struct SourceStamp
+{
+    long long modified;
+    long long size;                // -1 when the file is missing
+    unsigned long long hash;
+};
+
+struct AtlasHeader
+{
+    unsigned int magic;
+    int version;
+    int cellWidth;
+    int cellHeight;
+    int width;
+    int height;
+    int mipmaps;
+    int format;
+    long long dataSize;
+    SourceStamp sources[ATLAS_CELLS];
+};
+
+class CardAtlas {
+private:
+    static const unsigned int CACHE_MAGIC = 0x58545950;  // "PYTX"
+    static const int CACHE_VERSION = 1;
+
+    Texture2D texture;
+    int cellWidth;
+    int cellHeight;
+    bool present[ATLAS_CELLS];
+
+    static string sourcePath(int cell) {
         const char* suits[4] = { "H", "D", "C", "S" };
         const char* values[13] = {
             "A","2","3","4","5","6","7","8","9","10","J","Q","K"
         };
 
-        for (int s = 0; s < 4; s++) {
-            for (int v = 0; v < 13; v++) {
-                string path = "images/";
-                path += values[v];
-                path += suits[s];
-                path += ".JPG";
-                cardTextures[s][v] = LoadTexture(path.c_str());
-            }
-        }
+        if (cell == STOCK_CELL)
+            return "images/stock.jpg";
 
-        stockTexture = LoadTexture("images/stock.jpg");
-        background = LoadTexture("images/background.jpg");
+        string path = "images/";
+        path += values[cell % 13];
+        path += suits[cell / 13];
+        path += ".JPG";
+        return path;
     }
 
-    // ============================================
-    // MY CONTRIBUTION: CARD FLOW LOGIC
-    // ============================================
-
-    void createDeck() {
-        cardCount = 0;
-        for (int suit = 0; suit < 4; suit++) {
-            for (int value = 1; value <= 13; value++) {
-                allCards[cardCount] = Card(value, suit);
-                deck.pushBack(allCards[cardCount]);
-                cardCount++;
+    // FNV-1a over the whole file
+    static unsigned long long hashFile(const string& path) {
+        unsigned long long hash = 0xCBF29CE484222325ULL;
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return 0;
+
+        unsigned char buffer[16384];
+        size_t got;
+        while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            for (size_t i = 0; i < got; i++) {
+                hash = (hash ^ buffer[i]) * 0x100000001B3ULL;
             }
         }
+        fclose(file);
+        return hash;
     }
 
-    void shuffleDeck() {
-        srand(time(nullptr));
+    static void stampSource(int cell, SourceStamp& stamp) {
+        struct stat info;
+        stamp.hash = 0;
+        if (stat(sourcePath(cell).c_str(), &info) != 0) {
+            stamp.modified = 0;
+            stamp.size = -1;
+            return;
+        }
+        stamp.modified = (long long)info.st_mtime;
+        stamp.size = (long long)info.st_size;
+    }
 
-        Card tempDeck[52];
-        int index = 0;
-        ListNode<Card>* current = deck.getHead();
-        while (current) {
-            tempDeck[index++] = current->data;
-            current = current->next;
+    // Mipmapped RGBA8, every level stored one after the other
+    static long long pixelBytes(int width, int height, int mipmaps) {
+        long long total = 0;
+        for (int level = 0; level < mipmaps; level++) {
+            total += (long long)width * height * 4;
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
         }
+        return total;
+    }
 
-        for (int i = 51; i > 0; i--) {
-            int j = rand() % (i + 1);
-            swap(tempDeck[i], tempDeck[j]);
+    // Checks the cache against the sources and uploads it if it still holds.
+    // Stamps whose contents turned out unchanged are refreshed in the file.
+    bool loadCache(const char* cachePath, SourceStamp* stamps) {
+        size_t length = 0;
+        unsigned char* data = mapFile(cachePath, length);
+        if (!data)
+            return false;
+
+        AtlasHeader header;
+        bool valid = length >= sizeof(AtlasHeader);
+        if (valid) {
+            memcpy(&header, data, sizeof(header));
+            valid = header.magic == CACHE_MAGIC && header.version == CACHE_VERSION
+                && header.cellWidth == cellWidth && header.cellHeight == cellHeight
+                && header.format == PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+                && header.dataSize == pixelBytes(header.width, header.height, header.mipmaps)
+                && (long long)length >= (long long)sizeof(AtlasHeader) + header.dataSize;
         }
 
-        for (int i = 0; i < 52; i++) {
-            allCards[i] = tempDeck[i];
+        bool restamp = false;
+        for (int cell = 0; cell < ATLAS_CELLS && valid; cell++) {
+            SourceStamp& cached = header.sources[cell];
+            if (stamps[cell].size != cached.size) {
+                valid = false;
+            }
+            else if (stamps[cell].size >= 0 && stamps[cell].modified != cached.modified) {
+                stamps[cell].hash = hashFile(sourcePath(cell));
+                valid = stamps[cell].hash == cached.hash;
+                restamp = true;
+            }
+            else {
+                stamps[cell].hash = cached.hash;
+            }
         }
 
-        deck.clear();
-        for (int i = 0; i < 52; i++) {
-            deck.pushBack(allCards[i]);
+        if (valid) {
+            Image image = { data + sizeof(AtlasHeader), header.width, header.height, header.mipmaps, header.format };
+            texture = LoadTextureFromImage(image);
+            SetTextureFilter(texture, TEXTURE_FILTER_TRILINEAR);
+            for (int cell = 0; cell < ATLAS_CELLS; cell++) {
+                present[cell] = stamps[cell].size >= 0;
+            }
+        }
+        unmapFile(data, length);
+
+        if (valid && restamp) {
+            memcpy(header.sources, stamps, sizeof(header.sources));
+            FILE* file = fopen(cachePath, "r+b");
+            if (file) {
+                fwrite(&header, sizeof(header), 1, file);
+                fclose(file);
+            }
         }
+        return valid;
     }
 
-    void drawCardFromStock() {
-        moves++;
-
-        if (stock.isEmpty()) {
-            LinkedList<Card*> tempList;
-            ListNode<Card*>* backupNode = stockBackup.getHead();
-            while (backupNode) {
-                if (backupNode->data->inPlay) {
-                    tempList.pushBack(backupNode->data);
-                }
-                backupNode = backupNode->next;
+    // Decodes every source into one atlas, uploads it and writes the cache
+    void build(const char* cachePath, SourceStamp* stamps) {
+        int width = ATLAS_COLUMNS * cellWidth;
+        int height = ((ATLAS_CELLS + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS) * cellHeight;
+        Image atlas = GenImageColor(width, height, BLANK);
+
+        bool anyArt = false;
+        for (int cell = 0; cell < ATLAS_CELLS; cell++) {
+            present[cell] = false;
+            if (stamps[cell].size < 0)
+                continue;
+
+            string path = sourcePath(cell);
+            Image image = LoadImage(path.c_str());
+            if (!image.data) {
+                stamps[cell].size = -1;
+                continue;
             }
 
-            stock.clear();
-            ListNode<Card*>* tempNode = tempList.getHead();
-            while (tempNode) {
-                stock.pushBack(tempNode->data);
-                tempNode = tempNode->next;
-            }
+            ImageResize(&image, cellWidth, cellHeight);
+            ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+            ImageDraw(&atlas, image,
+                { 0, 0, (float)cellWidth, (float)cellHeight },
+                cellRect(cell), WHITE);
+            UnloadImage(image);
 
-            stockPosition = 0;
+            stamps[cell].hash = hashFile(path);
+            present[cell] = true;
+            anyArt = true;
         }
 
-        Card* card = stock.popFront();
-        card->faceUp = true;
-        currentWasteCard = card;
-        wasteHistory.pushBack(card);
-        stockPosition++;
-    }
+        // With no art at all every card falls back to drawn shapes
+        if (!anyArt) {
+            UnloadImage(atlas);
+            return;
+        }
 
-    void removeCards() {
-        if (selectedCard1 && isKing(selectedCard1)) {
-            selectedCard1->inPlay = false;
+        ImageMipmaps(&atlas);
+        texture = LoadTextureFromImage(atlas);
+        SetTextureFilter(texture, TEXTURE_FILTER_TRILINEAR);
+
+        AtlasHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = CACHE_MAGIC;
+        header.version = CACHE_VERSION;
+        header.cellWidth = cellWidth;
+        header.cellHeight = cellHeight;
+        header.width = atlas.width;
+        header.height = atlas.height;
+        header.mipmaps = atlas.mipmaps;
+        header.format = atlas.format;
+        header.dataSize = pixelBytes(atlas.width, atlas.height, atlas.mipmaps);
+        memcpy(header.sources, stamps, sizeof(header.sources));
+
+        // Written to the side and renamed, so a crash never leaves half a cache
+        string temp = string(cachePath) + ".tmp";
+        FILE* file = fopen(temp.c_str(), "wb");
+        if (file) {
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+                && fwrite(atlas.data, 1, (size_t)header.dataSize, file) == (size_t)header.dataSize;
+            if (fclose(file) != 0)
+                ok = false;
+            if (!ok || !replaceFile(temp.c_str(), cachePath))
+                remove(temp.c_str());
+        }
+        UnloadImage(atlas);
+    }
 
-            if (currentWasteCard == selectedCard1) {
-                wasteHistory.remove(currentWasteCard);
-                if (wasteHistory.isEmpty())
-                {
-                    currentWasteCard = NULL;
-                }
-                else
-                {
-                    currentWasteCard = wasteHistory.back();
-                }
-            }
+    // rename() on Windows refuses an existing target, so a stale cache would
+    // never be replaced. windows.h clashes with raylib, so no MoveFileEx:
+    // the old file goes first, which a crash in between only costs a rebuild.
+    static bool replaceFile(const char* temp, const char* target) {
+#ifdef _WIN32
+        remove(target);
+#endif
+        return rename(temp, target) == 0;
+    }
 
-            score += 10;
-            moves++;
-            selectedCard1 = nullptr;
-            selectedNode1 = nullptr;
-            updateBlockedStatus();
-            checkWinCondition();
-            return;
+    // The cache is read in place where the platform can map files
+    static unsigned char* mapFile(const char* path, size_t& length) {
+#ifdef _WIN32
+        FILE* file = fopen(path, "rb");
+        if (!file)
+            return nullptr;
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        unsigned char* data = size > 0 ? (unsigned char*)malloc(size) : nullptr;
+        if (data && fread(data, 1, size, file) != (size_t)size) {
+            free(data);
+            data = nullptr;
         }
+        fclose(file);
+        length = data ? (size_t)size : 0;
+        return data;
+#else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+        struct stat info;
+        void* data = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            length = (size_t)info.st_size;
+            data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        return data == MAP_FAILED ? nullptr : (unsigned char*)data;
+#endif
+    }
 
-        if (selectedCard1 && selectedCard2 && isValidMove(selectedCard1, selectedCard2)) {
-            selectedCard1->inPlay = false;
-            selectedCard2->inPlay = false;
+    static void unmapFile(unsigned char* data, size_t length) {
+#ifdef _WIN32
+        (void)length;
+        free(data);
+#else
+        munmap(data, length);
+#endif
+    }
 
-            if (currentWasteCard == selectedCard1 || currentWasteCard == selectedCard2) {
-                if (currentWasteCard == selectedCard1) {
-                    wasteHistory.remove(selectedCard1);
-                }
-                if (currentWasteCard == selectedCard2) {
-                    wasteHistory.remove(selectedCard2);
-                }
+public:
+    CardAtlas() {
+        texture = { 0 };
+        cellWidth = 0;
+        cellHeight = 0;
+        for (int cell = 0; cell < ATLAS_CELLS; cell++) {
+            present[cell] = false;
+        }
+    }
 
-                if (wasteHistory.isEmpty())
-                    currentWasteCard = NULL;
-                else
-                    currentWasteCard = wasteHistory.back();
-            }
+    // Card art at cell size, from the cache when it is still current
+    void load(int width, int height, const char* cachePath) {
+        unload();
+        cellWidth = width;
+        cellHeight = height;
 
-            score += 20;
-            moves++;
+        SourceStamp stamps[ATLAS_CELLS];
+        for (int cell = 0; cell < ATLAS_CELLS; cell++) {
+            stampSource(cell, stamps[cell]);
+        }
 
-            selectedCard1 = nullptr;
-            selectedCard2 = nullptr;
-            selectedNode1 = nullptr;
-            selectedNode2 = nullptr;
+        if (!loadCache(cachePath, stamps))
+            build(cachePath, stamps);
+    }
 
-            updateBlockedStatus();
-            checkWinCondition();
-        }
-        else if (selectedCard1 && selectedCard2) {
-            moves++;
-            selectedCard1 = nullptr;
-            selectedCard2 = nullptr;
-            selectedNode1 = nullptr;
-            selectedNode2 = nullptr;
+    void unload() {
+        if (texture.id != 0)
+            UnloadTexture(texture);
+        texture = { 0 };
+        for (int cell = 0; cell < ATLAS_CELLS; cell++) {
+            present[cell] = false;
         }
     }
 
-    void initGame() {
-        clearPyramid();
-        deck.clear();
-        stock.clear();
-        stockBackup.clear();
-        wasteHistory.clear();
-
-        selectedCard1 = nullptr;
-        selectedCard2 = nullptr;
-        selectedNode1 = nullptr;
-        selectedNode2 = nullptr;
-        currentWasteCard = nullptr;
-        score = 0;
-        moves = 0;
-        gameTime = 0.0f;
-        gameWon = false;
-        gameLost = false;
-        cardCount = 0;
-        stockPosition = 0;
-
-        createDeck();
-        shuffleDeck();
-        createPyramid();
+    bool hasArt(int cell) {
+        return texture.id != 0 && present[cell];
+    }
 
-        for (int i = 28; i < 52; i++) {
-            stock.pushBack(&allCards[i]);
-            stockBackup.pushBack(&allCards[i]);
-        }
+    Texture2D getTexture() {
+        return texture;
+    }
 
-        state = PLAYING;
+    Rectangle cellRect(int cell) {
+        return {
+            (float)((cell % ATLAS_COLUMNS) * cellWidth),
+            (float)((cell / ATLAS_COLUMNS) * cellHeight),
+            (float)cellWidth,
+            (float)cellHeight
+        };
     }
+};
 
-    // ============================================
-    // PREVIOUS TEAM MEMBER'S FUNCTIONS
-    // ============================================
+// A mouse click, captured on the render thread with the window size it was made against
+struct InputEvent
+{
+    float x;
+    float y;
+    int screenWidth;
+    int screenHeight;
+};
 
-    void createPyramid() {
-        int cardIndex = 0;
-        PyramidNode* prevRowHeads[7] = { nullptr };
+// Everything render() needs, copied out by the simulation thread each tick.
+// The position is a plain value, so this is a straight copy.
+struct RenderSnapshot
+{
+    ScreenState screen;
+    Deal deal;
+    GameState game;
+    long long playTicks;
+    long long revision;     // changes whenever anything on screen does
+};
 
-        for (int row = 0; row < 7; row++) {
-            PyramidNode* rowHead = nullptr;
-            PyramidNode* rowTail = nullptr;
+// Game class
+// The position lives in an engine GameState; this class adds the deck
+// building, input, timing and drawing around it
+class PyramidSolitaire {
+private:
+    typedef PyramidEngine<ClassicRules> Engine;
 
-            for (int col = 0; col <= row; col++) {
-                Card* card = &allCards[cardIndex++];
-                card->faceUp = true;
-                PyramidNode* node = new PyramidNode(card, row, col);
+    // MY CONTRIBUTION: Card Flow Data Members
+    LinkedList<Card> deck;
+    Deal deal;
+    GameState game;
 
-                if (!rowHead) {
-                    rowHead = node;
-                    rowTail = node;
-                }
-                else {
-                    rowTail->nextInRow = node;
-                    rowTail = node;
-                }
+    long long playTicks;       // simulation ticks spent playing, exact game time
+    long long loseCheckTicks;
 
-                if (row > 0) {
-                    PyramidNode* prevRowNode = prevRowHeads[row - 1];
-                    int count = 0;
-                    while (prevRowNode && count < col) {
-                        prevRowNode = prevRowNode->nextInRow;
-                        count++;
-                    }
+    Texture2D background;
+    CardAtlas cardArt;
+    float textureScale;        // DPI scale the card art was sized for
 
-                    if (prevRowNode && count == col) {
-                        if (col < row) {
-                            prevRowNode->left = node;
-                        }
-                        if (col > 0) {
-                            PyramidNode* leftParent = prevRowHeads[row - 1];
-                            count = 0;
-                            while (leftParent && count < col - 1) {
-                                leftParent = leftParent->nextInRow;
-                                count++;
-                            }
-                            if (leftParent) {
-                                leftParent->right = node;
-                            }
-                        }
-                    }
-                }
+    ScreenState screen;
 
-                if (row == 6) {
-                    node->blocked = false;
-                }
-            }
+    const int CARD_WIDTH = 90;
+    const int CARD_HEIGHT = 130;
+    const int CARD_SPACING = 20;
+    const int TICKS_PER_SECOND = 60;
+
+    // Simulation thread
+    SpscQueue<InputEvent, 256> inputQueue;
+    SnapshotBuffer<RenderSnapshot> snapshots;
+    thread simThread;
+    atomic<bool> simRunning;
+    atomic<bool> exitRequested;
+    EventTrace trace;
+    long long revision;             // simulation thread: bumped on every visible change
+    long long publishedRevision;
+    long long drawnRevision;        // render thread: revision of the frame on screen
+    long long inputsPushed;         // render thread
+    atomic<long long> inputsHandled;
+
+    // The simulation thread parks here while nothing is timed
+    mutex wakeLock;
+    condition_variable wakeSignal;
+    bool wakePending;
+
+#ifdef TRACK_ALLOCATIONS
+    long long gameAllocationStart;
+#endif
 
-            pyramidRows[row] = rowHead;
-            prevRowHeads[row] = rowHead;
+public:
+    // headless skips the window resources, for --check-allocations
+    PyramidSolitaire(bool headless = false) {
+        memset(&deal, 0, sizeof(deal));
+        resetState(game);
+        playTicks = 0;
+        loseCheckTicks = 0;
+        screen = MAIN_MENU;
+        simRunning = false;
+        exitRequested = false;
+        revision = 0;
+        publishedRevision = -1;
+        drawnRevision = -1;
+        inputsPushed = 0;
+        inputsHandled = 0;
+        wakePending = false;
+#ifdef TRACK_ALLOCATIONS
+        gameAllocationStart = 0;
+#endif
+
+        // The deck has a fixed size, so allocate all its nodes up front
+        deck.reserve(52);
+
+        background = { 0 };
+        textureScale = 1.0f;
+        if (!headless) {
+            loadCardTextures();
+            background = LoadTexture("images/background.jpg");
         }
+        publishSnapshot();
     }
 
-    void clearPyramid() {
-        for (int row = 0; row < 7; row++) {
-            PyramidNode* current = pyramidRows[row];
-            while (current) {
-                PyramidNode* next = current->nextInRow;
-                delete current;
-                current = next;
-            }
-            pyramidRows[row] = nullptr;
-        }
+    ~PyramidSolitaire() {
+        stopSimulation();
+        unloadCardTextures();
+        if (background.id != 0)
+            UnloadTexture(background);
     }
 
-    void updateBlockedStatus() {
-        for (int row = 0; row < 7; row++) {
-            PyramidNode* current = pyramidRows[row];
-            while (current) {
-                if (current->card && current->card->inPlay) {
-                    bool leftBlocking = (current->left && current->left->card && current->left->card->inPlay);
-                    bool rightBlocking = (current->right && current->right->card && current->right->card->inPlay);
-                    current->blocked = leftBlocking || rightBlocking;
-                }
-                current = current->nextInRow;
-            }
-        }
+    // The current deal and position. Copy the position to try moves on it
+    // with PyramidEngine without touching the game.
+    const Deal& currentDeal() {
+        return deal;
     }
 
-    bool isCardFree(PyramidNode* node) {
-        if (!node || !node->card || !node->card->inPlay)
-            return false;
-
-        return !node->blocked;
+    GameState position() {
+        return game;
     }
 
-    bool isValidMove(Card* c1, Card* c2) {
-        if (!c1 || !c2)
-            return false;
-
-        if (!c1->inPlay || !c2->inPlay)
-            return false;
-
-        return (c1->value + c2->value) == 13;
+    // Card art is shrunk once, to the size it is drawn at, so the GPU keeps
+    // small textures and never has to minify full-size photos every frame
+    void loadCardTextures() {
+        textureScale = GetWindowScaleDPI().x;
+        int width = (int)(CARD_WIDTH * textureScale + 0.5f);
+        int height = (int)(CARD_HEIGHT * textureScale + 0.5f);
+        cardArt.load(width, height, "images/cards.cache");
     }
 
-    bool isKing(Card* c) {
-        if (!c)
-            return false;
+    void unloadCardTextures() {
+        cardArt.unload();
+    }
 
-        return c->value == 13;
+    // Moving the window to a screen with another DPI scale changes how many
+    // pixels a card covers, so the textures are rebuilt to match
+    bool cardTexturesOutdated() {
+        return GetWindowScaleDPI().x != textureScale;
     }
 
-    void selectCard(Card* card, PyramidNode* node) {
-        if (!card || !card->inPlay)
+    void refreshCardTextures() {
+        if (!cardTexturesOutdated())
             return;
+        unloadCardTextures();
+        loadCardTextures();
+    }
 
-        if (node && !isCardFree(node))
-            return;
+    // ============================================
+    // MY CONTRIBUTION: CARD FLOW LOGIC
+    // ============================================
 
-        if (isKing(card)) {
-            selectedCard1 = card;
-            selectedNode1 = node;
-            selectedCard2 = nullptr;
-            selectedNode2 = nullptr;
-            removeCards();
-            return;
+    void createDeck() {
+        for (int suit = 0; suit < 4; suit++) {
+            for (int value = 1; value <= 13; value++) {
+                deck.pushBack(Card(value, suit));
+            }
         }
+    }
 
-        if (!selectedCard1) {
-            selectedCard1 = card;
-            selectedNode1 = node;
-        }
-        else if (selectedCard1 == card) {
-            selectedCard1 = nullptr;
-            selectedNode1 = nullptr;
-        }
-        else {
-            selectedCard2 = card;
-            selectedNode2 = node;
-            removeCards();
+    // rand() is seeded once in main; reseeding here from the clock would
+    // deal the same hand again on a restart within the same second
+    void shuffleDeck() {
+        Card tempDeck[52];
+        int index = 0;
+        ListNode<Card>* current = deck.getHead();
+        while (current) {
+            tempDeck[index++] = current->data;
+            current = current->next;
         }
-    }
 
-    void checkWinCondition() {
-        bool allRemoved = true;
-        for (int row = 0; row < 7; row++) {
-            PyramidNode* current = pyramidRows[row];
-            while (current) {
-                if (current->card && current->card->inPlay) {
-                    allRemoved = false;
-                    break;
-                }
-                current = current->nextInRow;
-            }
-            if (!allRemoved)
-                break;
+        for (int i = 51; i > 0; i--) {
+            int j = rand() % (i + 1);
+            swap(tempDeck[i], tempDeck[j]);
         }
 
-        if (allRemoved) {
-            gameWon = true;
+        deck.clear();
+        for (int i = 0; i < 52; i++) {
+            deck.pushBack(tempDeck[i]);
         }
     }
 
-    void checkLoseCondition() {
-        LinkedList<Card*> freeCards;
-
-        for (int row = 0; row < 7; row++) {
-            PyramidNode* current = pyramidRows[row];
-            while (current) {
-                if (isCardFree(current)) {
-                    freeCards.pushBack(current->card);
-                }
-                current = current->nextInRow;
-            }
+    // The first 28 cards of the shuffled deck form the pyramid, the rest the stock
+    void dealFromDeck() {
+        int slot = 0;
+        ListNode<Card>* current = deck.getHead();
+        while (current && slot < DECK_SIZE) {
+            deal.cards[slot++] = packCard(current->data.value, current->data.suit);
+            current = current->next;
         }
+    }
 
-        if (currentWasteCard && currentWasteCard->inPlay) {
-            freeCards.pushBack(currentWasteCard);
-        }
+    // Recycles the stock when it runs out, like turning the waste pile over
+    void drawCardFromStock() {
+        GameState before = game;
+        bool drew = Engine::drawFromStock(game);
+        game.selected = NO_SLOT;
 
-        ListNode<Card*>* checkNode = freeCards.getHead();
-        while (checkNode) {
-            if (isKing(checkNode->data))
-                return;
+        if (drew)
+            trace.record(game.passes != before.passes ? TRACE_RECYCLE : TRACE_DRAW, wasteTop(game), NO_SLOT, before, game);
+    }
 
-            checkNode = checkNode->next;
+    void initGame() {
+#ifdef TRACK_ALLOCATIONS
+        if (screen == PLAYING) {
+            cout << "game: " << (allocationCount - gameAllocationStart) << " heap allocations" << endl;
         }
+        gameAllocationStart = allocationCount;
+#endif
+        deck.clear();
+        playTicks = 0;
+        loseCheckTicks = 0;
 
-        ListNode<Card*>* node1 = freeCards.getHead();
-        while (node1) {
-            ListNode<Card*>* node2 = node1->next;
-            while (node2) {
-                if (isValidMove(node1->data, node2->data)) {
-                    return;
-                }
-                node2 = node2->next;
-            }
-            node1 = node1->next;
-        }
+        createDeck();
+        shuffleDeck();
+        dealFromDeck();
+        resetState(game);
+        trace.record(TRACE_NEW_GAME, NO_SLOT, NO_SLOT, game, game);
 
-        if (!stock.isEmpty())
-            return;
+        screen = PLAYING;
+    }
 
-        ListNode<Card*>* backupCheckNode = stockBackup.getHead();
-        while (backupCheckNode) {
-            if (backupCheckNode->data->inPlay)
-                return;
+    // ============================================
+    // PREVIOUS TEAM MEMBER'S FUNCTIONS
+    // ============================================
 
-            backupCheckNode = backupCheckNode->next;
+    // Kings go straight away; otherwise the second card either completes a
+    // pair or clears the selection
+    void selectCard(int slot) {
+        GameState before = game;
+        Engine::selectSlot(deal, game, slot);
+        traceSelection(before, slot);
+    }
+
+    // Works out what the click just did, for the trace
+    void traceSelection(const GameState& before, int slot) {
+        if (game.removed != before.removed) {
+            if (__builtin_popcountll(game.removed ^ before.removed) == 1)
+                trace.record(TRACE_KING, slot, NO_SLOT, before, game);
+            else
+                trace.record(before.selected >= PYRAMID_CARDS || slot >= PYRAMID_CARDS ? TRACE_WASTE_PAIR : TRACE_PAIR,
+                             before.selected, slot, before, game);
+            if (game.won)
+                trace.record(TRACE_WIN, NO_SLOT, NO_SLOT, game, game);
+        }
+        else if (game.moves != before.moves) {
+            trace.record(TRACE_MISMATCH, before.selected, slot, before, game);
+        }
+        else if (game.selected != before.selected) {
+            trace.record(game.selected == NO_SLOT ? TRACE_UNSELECT : TRACE_SELECT, slot, NO_SLOT, before, game);
         }
+    }
 
-        gameLost = true;
+    void checkLoseCondition() {
+        Engine::checkLose(deal, game);
+        if (game.lost)
+            trace.record(TRACE_LOSS, NO_SLOT, NO_SLOT, game, game);
     }
 
-    void handleMouseClick(int mouseX, int mouseY) {
-        if (gameWon || gameLost)
+    void handleMouseClick(int mouseX, int mouseY, int sw) {
+        if (game.won || game.lost)
             return;
 
-        for (int row = 0; row < 7; row++) {
-            PyramidNode* current = pyramidRows[row];
-            while (current) {
-                if (current->card && current->card->inPlay) {
-                    Rectangle cardRect = getPyramidCardRect(row, current->col);
-                    if (CheckCollisionPointRec({ (float)mouseX, (float)mouseY }, cardRect)) {
-                        selectCard(current->card, current);
-                        return;
-                    }
+        for (int row = 0; row < PYRAMID_ROWS; row++) {
+            for (int col = 0; col <= row; col++) {
+                int slot = pyramidSlot(row, col);
+                if (isRemoved(game, slot))
+                    continue;
+
+                Rectangle cardRect = getPyramidCardRect(row, col, sw);
+                if (CheckCollisionPointRec({ (float)mouseX, (float)mouseY }, cardRect)) {
+                    selectCard(slot);
+                    return;
                 }
-                current = current->nextInRow;
             }
         }
 
-        if (currentWasteCard && currentWasteCard->inPlay) {
+        int waste = wasteTop(game);
+        if (waste != NO_SLOT) {
             int uiStartY = 150 + 7 * (CARD_HEIGHT / 2 + CARD_SPACING);
             Rectangle wasteRect = { 50, (float)uiStartY, CARD_WIDTH, CARD_HEIGHT };
             if (CheckCollisionPointRec({ (float)mouseX, (float)mouseY }, wasteRect)) {
-                selectCard(currentWasteCard, nullptr);
+                selectCard(waste);
                 return;
             }
         }
 
-        if (CheckCollisionPointRec({ (float)mouseX, (float)mouseY }, stockRect)) {
+        if (CheckCollisionPointRec({ (float)mouseX, (float)mouseY }, getStockRect())) {
             drawCardFromStock();
-            selectedCard1 = nullptr;
-            selectedCard2 = nullptr;
-            selectedNode1 = nullptr;
-            selectedNode2 = nullptr;
             return;
         }
     }
 
-    Rectangle getPyramidCardRect(int row, int col) {
-        int startX = (GetScreenWidth() / 2) - (row * (CARD_WIDTH + CARD_SPACING) / 2);
+    Rectangle getPyramidCardRect(int row, int col, int sw) {
+        int startX = (sw / 2) - (row * (CARD_WIDTH + CARD_SPACING) / 2);
         int x = startX + col * (CARD_WIDTH + CARD_SPACING);
         int y = 100 + row * (CARD_HEIGHT / 2 + CARD_SPACING);
         return { (float)x, (float)y, (float)CARD_WIDTH, (float)CARD_HEIGHT };
     }
 
-    void drawCard(Card* card, Rectangle rect, bool selected) {
-        if (!card)
-            return;
-
-        if (!card->faceUp) {
-            DrawRectangleRec(rect, DARKBLUE);
-            DrawRectangleLinesEx(rect, 2, BLACK);
-            DrawText("?", rect.x + rect.width / 2 - 10, rect.y + rect.height / 2 - 10, 30, WHITE);
-            return;
-        }
+    Rectangle getStockRect() {
+        int uiStartY = 150 + 7 * (CARD_HEIGHT / 2 + CARD_SPACING);
+        return { 180.0f, (float)uiStartY, (float)CARD_WIDTH, (float)CARD_HEIGHT };
+    }
 
-        Texture2D tex = cardTextures[card->suit][card->value - 1];
+    void drawCard(unsigned char card, Rectangle rect, bool selected) {
+        int value = cardValue(card);
+        int suit = cardSuit(card);
+        int cell = suit * 13 + value - 1;
 
-        if (tex.id != 0) {
+        if (cardArt.hasArt(cell)) {
             DrawTexturePro(
-                tex,
-                { 0, 0, (float)tex.width, (float)tex.height },
+                cardArt.getTexture(),
+                cardArt.cellRect(cell),
                 rect,
                 { 0, 0 },
                 0,
@@ -770,15 +1115,15 @@ public:
             );
         }
         else {
-            Color suitColor = (card->suit == 0 || card->suit == 1) ? RED : BLACK;
+            Color suitColor = (suit == 0 || suit == 1) ? RED : BLACK;
             DrawRectangleRec(rect, WHITE);
             DrawRectangleLinesEx(rect, 2, BLACK);
 
             const char* values[13] = { "A","2","3","4","5","6","7","8","9","10","J","Q","K" };
-            DrawText(values[card->value - 1], rect.x + 10, rect.y + 10, 20, suitColor);
+            DrawText(values[value - 1], rect.x + 10, rect.y + 10, 20, suitColor);
 
             const char* suitSymbols[4] = { "♥", "♦", "♣", "♠" };
-            DrawText(suitSymbols[card->suit], rect.x + 10, rect.y + 35, 25, suitColor);
+            DrawText(suitSymbols[suit], rect.x + 10, rect.y + 35, 25, suitColor);
         }
 
         if (selected) {
@@ -878,10 +1223,7 @@ public:
         EndDrawing();
     }
 
-    void handleMainMenuClick(int mouseX, int mouseY) {
-        int sw = GetScreenWidth();
-        int sh = GetScreenHeight();
-
+    void handleMainMenuClick(int mouseX, int mouseY, int sw, int sh) {
         Rectangle playBtn = { (float)(sw / 2 - 150), (float)(sh / 2 - 130), 300, 60 };
         Rectangle instructBtn = { (float)(sw / 2 - 150), (float)(sh / 2 - 40), 300, 60 };
         Rectangle exitBtn = { (float)(sw / 2 - 150), (float)(sh / 2 + 50), 300, 60 };
@@ -890,31 +1232,31 @@ public:
             initGame();
         }
         else if (CheckCollisionPointRec({ (float)mouseX, (float)mouseY }, instructBtn)) {
-            state = INSTRUCTIONS;
+            screen = INSTRUCTIONS;
         }
         else if (CheckCollisionPointRec({ (float)mouseX, (float)mouseY }, exitBtn)) {
-            CloseWindow();
-            exit(0);
+            exitRequested = true;
         }
     }
 
-    void handleInstructionsClick(int mouseX, int mouseY) {
-        int sw = GetScreenWidth();
-        int sh = GetScreenHeight();
-
+    void handleInstructionsClick(int mouseX, int mouseY, int sw, int sh) {
         Rectangle backBtn = { (float)(sw / 2 - 100), (float)(sh - 120), 200, 50 };
         if (CheckCollisionPointRec({ (float)mouseX, (float)mouseY }, backBtn)) {
-            state = MAIN_MENU;
+            screen = MAIN_MENU;
         }
     }
 
     void render() {
-        if (state == MAIN_MENU) {
+        const RenderSnapshot& snap = snapshots.read();
+        drawnRevision = snap.revision;
+        refreshCardTextures();
+
+        if (snap.screen == MAIN_MENU) {
             renderMainMenu();
             return;
         }
 
-        if (state == INSTRUCTIONS) {
+        if (snap.screen == INSTRUCTIONS) {
             renderInstructions();
             return;
         }
@@ -924,40 +1266,39 @@ public:
 
         int sw = GetScreenWidth();
         int sh = GetScreenHeight();
-        DrawText(TextFormat("Moves: %d", moves), sw - 150, 20, 25, YELLOW);
+        const GameState& game = snap.game;
+        DrawText(TextFormat("Moves: %d", game.moves), sw - 150, 20, 25, YELLOW);
 
-        for (int row = 0; row < 7; row++) {
-            PyramidNode* current = pyramidRows[row];
-            while (current) {
-                if (current->card && current->card->inPlay) {
-                    Rectangle rect = getPyramidCardRect(row, current->col);
-                    bool selected = (current == selectedNode1 || current == selectedNode2);
-                    drawCard(current->card, rect, selected);
+        for (int row = 0; row < PYRAMID_ROWS; row++) {
+            for (int col = 0; col <= row; col++) {
+                int slot = pyramidSlot(row, col);
+                if (!isRemoved(game, slot)) {
+                    Rectangle rect = getPyramidCardRect(row, col, sw);
+                    drawCard(snap.deal.cards[slot], rect, slot == game.selected);
 
-                    if (current->blocked) {
+                    if (!isPyramidSlotFree(game, slot)) {
                         DrawRectangle(rect.x, rect.y, rect.width, 5, RED);
                     }
                 }
-                current = current->nextInRow;
             }
         }
 
         int uiStartY = 150 + 7 * (CARD_HEIGHT / 2 + CARD_SPACING);
 
         DrawText("WASTE", 50, uiStartY - 30, 20, WHITE);
-        if (currentWasteCard && currentWasteCard->inPlay) {
-            Rectangle wasteRect = { 50, (float)uiStartY, CARD_WIDTH, CARD_HEIGHT };
-            bool selected = (currentWasteCard == selectedCard1 || currentWasteCard == selectedCard2);
-            drawCard(currentWasteCard, wasteRect, selected);
+        int waste = wasteTop(game);
+        if (waste != NO_SLOT) {
+            Rectangle wasteRect = { 50, (float)uiStartY, (float)CARD_WIDTH, (float)CARD_HEIGHT };
+            drawCard(snap.deal.cards[waste], wasteRect, waste == game.selected);
         }
 
-        stockRect = { 180.0f, (float)uiStartY, (float)CARD_WIDTH, (float)CARD_HEIGHT };
+        Rectangle stockRect = getStockRect();
         DrawText("STOCK", 180, uiStartY - 30, 20, WHITE);
 
-        if (stockTexture.id != 0) {
+        if (cardArt.hasArt(STOCK_CELL)) {
             DrawTexturePro(
-                stockTexture,
-                { 0, 0, (float)stockTexture.width, (float)stockTexture.height },
+                cardArt.getTexture(),
+                cardArt.cellRect(STOCK_CELL),
                 stockRect, { 0, 0 }, 0, WHITE
             );
         }
@@ -965,12 +1306,12 @@ public:
             DrawRectangleRec(stockRect, BLUE);
             DrawRectangleLinesEx(stockRect, 2, WHITE);
         }
-        int totalSeconds = (int)gameTime;
+        int totalSeconds = (int)(snap.playTicks / TICKS_PER_SECOND);
         int hours = totalSeconds / 3600;
         int minutes = (totalSeconds % 3600) / 60;
         int seconds = totalSeconds % 60;
 
-        DrawText(TextFormat("Score: %d", score), sw / 2 - 60, sh - 60, 25, WHITE);
+        DrawText(TextFormat("Score: %d", game.score), sw / 2 - 60, sh - 60, 25, WHITE);
         DrawText(TextFormat("Time: %02d:%02d:%02d", hours, minutes, seconds), sw / 2 - 80, sh - 30, 25, WHITE);
 
         Rectangle restartBtn = { (float)(sw - 150), (float)(sh - 60), 120, 50 };
@@ -978,76 +1319,335 @@ public:
         DrawRectangleLinesEx(restartBtn, 2, WHITE);
         DrawText("RESTART", sw - 140, sh - 45, 20, WHITE);
 
-        if (gameWon) {
+        if (game.won) {
             DrawRectangle(0, 0, sw, sh, { 0, 0, 0, 150 });
             DrawText("YOU WIN!", sw / 2 - 100, sh / 2 - 50, 40, GOLD);
-            DrawText(TextFormat("Score: %d", score), sw / 2 - 80, sh / 2 + 10, 30, WHITE);
+            DrawText(TextFormat("Score: %d", game.score), sw / 2 - 80, sh / 2 + 10, 30, WHITE);
         }
-        else if (gameLost) {
+        else if (game.lost) {
             DrawRectangle(0, 0, sw, sh, { 0, 0, 0, 150 });
             DrawText("NO MOVES LEFT!", sw / 2 - 150, sh / 2 - 50, 40, RED);
-            DrawText(TextFormat("Score: %d", score), sw / 2 - 80, sh / 2 + 10, 30, WHITE);
+            DrawText(TextFormat("Score: %d", game.score), sw / 2 - 80, sh / 2 + 10, 30, WHITE);
         }
 
         EndDrawing();
     }
 
-    void update(float deltaTime) {
-        if (state == MAIN_MENU) {
-            if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
-                Vector2 mousePos = GetMousePosition();
-                handleMainMenuClick((int)mousePos.x, (int)mousePos.y);
-            }
+    // ============================================
+    // SIMULATION THREAD
+    // Rules run at a fixed tick, independent of the frame rate. The render
+    // thread only pushes input and reads published snapshots.
+    // ============================================
+
+    void pollInput() {
+        if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+            Vector2 mousePos = GetMousePosition();
+            InputEvent ev = { mousePos.x, mousePos.y, GetScreenWidth(), GetScreenHeight() };
+            pushInput(ev);
+        }
+    }
+
+    void pushInput(const InputEvent& ev) {
+        if (!inputQueue.push(ev))
             return;
+        inputsPushed++;
+
+        {
+            lock_guard<mutex> guard(wakeLock);
+            wakePending = true;
         }
+        wakeSignal.notify_one();
+    }
 
-        if (state == INSTRUCTIONS) {
-            if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
-                Vector2 mousePos = GetMousePosition();
-                handleInstructionsClick((int)mousePos.x, (int)mousePos.y);
-            }
+    void handleInput(const InputEvent& ev) {
+        revision++;
+
+        int mouseX = (int)ev.x;
+        int mouseY = (int)ev.y;
+        int sw = ev.screenWidth;
+        int sh = ev.screenHeight;
+
+        if (screen == MAIN_MENU) {
+            handleMainMenuClick(mouseX, mouseY, sw, sh);
             return;
         }
 
-        if (!gameWon && !gameLost) {
-            gameTime += deltaTime;
+        if (screen == INSTRUCTIONS) {
+            handleInstructionsClick(mouseX, mouseY, sw, sh);
+            return;
+        }
+
+        Rectangle restartBtn = { (float)(sw - 150), (float)(sh - 60), 120, 50 };
+        if (CheckCollisionPointRec({ ev.x, ev.y }, restartBtn)) {
+            initGame();
+            return;
+        }
+
+        handleMouseClick(mouseX, mouseY, sw);
+    }
+
+    // Only a game in progress changes without input: its clock and lose check
+    bool clockRunning() {
+        return screen == PLAYING && !game.won && !game.lost;
+    }
+
+    void tick() {
+        if (!clockRunning())
+            return;
+
+        // The clock only shows whole seconds, so only those need a redraw
+        playTicks++;
+        if (playTicks % TICKS_PER_SECOND == 0)
+            revision++;
+
+        loseCheckTicks++;
+        if (loseCheckTicks >= TICKS_PER_SECOND) {
+            checkLoseCondition();
+            loseCheckTicks = 0;
+            if (game.lost)
+                revision++;
+        }
+    }
+
+    void publishSnapshot() {
+        RenderSnapshot& snap = snapshots.beginWrite();
+
+        snap.screen = screen;
+        snap.deal = deal;
+        snap.game = game;
+        snap.playTicks = playTicks;
+        snap.revision = revision;
+        publishedRevision = revision;
+
+        snapshots.publish();
+    }
+
+    void simulationLoop() {
+        chrono::nanoseconds tickLength(1000000000LL / TICKS_PER_SECOND);
+        chrono::steady_clock::time_point nextTick = chrono::steady_clock::now();
+
+        while (simRunning) {
+            InputEvent ev;
+            long long handled = 0;
+            while (inputQueue.pop(ev)) {
+                handleInput(ev);
+                handled++;
+            }
 
-            static float checkTimer = 0.0f;
-            checkTimer += deltaTime;
-            if (checkTimer >= 1.0f) {
-                checkLoseCondition();
-                checkTimer = 0.0f;
+            tick();
+            if (revision != publishedRevision)
+                publishSnapshot();
+            inputsHandled += handled;   // after publishing, so the result is already visible
+
+            // Menus and finished games only change on input, so park until some arrives
+            if (!clockRunning()) {
+                unique_lock<mutex> guard(wakeLock);
+                wakeSignal.wait(guard, [this] { return wakePending || !simRunning; });
+                wakePending = false;
+                nextTick = chrono::steady_clock::now();
+                continue;
             }
+
+            // Sleep to an absolute deadline so late ticks catch up instead of drifting
+            nextTick += tickLength;
+            this_thread::sleep_until(nextTick);
         }
+    }
 
-        if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
-            Vector2 mousePos = GetMousePosition();
+    void startSimulation() {
+        simRunning = true;
+        simThread = thread(&PyramidSolitaire::simulationLoop, this);
+    }
 
-            int sw = GetScreenWidth();
-            int sh = GetScreenHeight();
-            Rectangle restartBtn = { (float)(sw - 150), (float)(sh - 60), 120, 50 };
-            if (CheckCollisionPointRec(mousePos, restartBtn)) {
-                initGame();
-                return;
+    void stopSimulation() {
+        {
+            lock_guard<mutex> guard(wakeLock);
+            simRunning = false;
+        }
+        wakeSignal.notify_one();
+        if (simThread.joinable())
+            simThread.join();
+        trace.stop();
+    }
+
+    // Call before startSimulation(); the game plays on untraced if the file cannot be opened
+    bool startTrace(const char* path) {
+        return trace.start(path);
+    }
+
+#ifdef TRACK_ALLOCATIONS
+    // Clicks the centre of rect and runs the tick that follows, the way the
+    // simulation thread would
+    void scriptedClick(Rectangle rect, int sw, int sh) {
+        InputEvent ev = { rect.x + rect.width / 2, rect.y + rect.height / 2, sw, sh };
+        handleInput(ev);
+        for (int t = 0; t < TICKS_PER_SECOND / 4; t++) {
+            tick();
+        }
+        if (revision != publishedRevision)
+            publishSnapshot();
+    }
+
+    Rectangle slotRect(int slot, int sw) {
+        if (slot >= PYRAMID_CARDS) {
+            int uiStartY = 150 + 7 * (CARD_HEIGHT / 2 + CARD_SPACING);
+            return { 50.0f, (float)uiStartY, (float)CARD_WIDTH, (float)CARD_HEIGHT };
+        }
+        int row = slotRow(slot);
+        return getPyramidCardRect(row, slot - pyramidSlot(row, 0), sw);
+    }
+
+    // Plays the current game by clicking: a king or the first pair found,
+    // otherwise the stock, until the game ends or maxClicks runs out
+    void playScriptedGame(int sw, int sh, int maxClicks) {
+        for (int click = 0; click < maxClicks && screen == PLAYING && !game.won && !game.lost; click++) {
+            int slots[PYRAMID_CARDS + 1];
+            int count = 0;
+            for (int slot = 0; slot < PYRAMID_CARDS; slot++) {
+                if (isPyramidSlotFree(game, slot))
+                    slots[count++] = slot;
+            }
+            if (wasteTop(game) != NO_SLOT)
+                slots[count++] = wasteTop(game);
+
+            int first = NO_SLOT;
+            int second = NO_SLOT;
+            for (int i = 0; i < count && first == NO_SLOT; i++) {
+                int value = cardValue(deal.cards[slots[i]]);
+                if (Engine::isSingle(value)) {
+                    first = slots[i];
+                    break;
+                }
+                for (int j = i + 1; j < count; j++) {
+                    if (Engine::isPair(value, cardValue(deal.cards[slots[j]]))) {
+                        first = slots[i];
+                        second = slots[j];
+                        break;
+                    }
+                }
             }
 
-            handleMouseClick((int)mousePos.x, (int)mousePos.y);
+            if (first == NO_SLOT) {
+                scriptedClick(getStockRect(), sw, sh);
+                continue;
+            }
+            scriptedClick(slotRect(first, sw), sw, sh);
+            if (second != NO_SLOT)
+                scriptedClick(slotRect(second, sw), sw, sh);
         }
     }
+
+    // Starts from the menu, plays one game to warm up, then plays games more
+    // through the restart button. Returns the heap allocations made after
+    // the warm-up, which should be none.
+    long long checkSteadyStateAllocations(int games) {
+        const int sw = 1200;
+        const int sh = 800;
+        const int maxClicks = 600;
+        Rectangle playBtn = { (float)(sw / 2 - 150), (float)(sh / 2 - 130), 300, 60 };
+        Rectangle restartBtn = { (float)(sw - 150), (float)(sh - 60), 120, 50 };
+
+        scriptedClick(playBtn, sw, sh);
+        playScriptedGame(sw, sh, maxClicks);
+
+        long long start = allocationCount;
+        for (int g = 0; g < games; g++) {
+            scriptedClick(restartBtn, sw, sh);
+            playScriptedGame(sw, sh, maxClicks);
+        }
+        return allocationCount - start;
+    }
+#endif
+
+    bool isExitRequested() {
+        return exitRequested;
+    }
+
+    // True when the frame on screen is out of date
+    bool needsRedraw() {
+        return IsWindowResized() || cardTexturesOutdated() || snapshots.read().revision != drawnRevision;
+    }
+
+    // True when nothing can change until the window gets an event: all input
+    // has been handled and no game clock is running
+    bool waitingForInput() {
+        const RenderSnapshot& snap = snapshots.read();
+        bool clock = snap.screen == PLAYING && !snap.game.won && !snap.game.lost;
+        return !clock && inputsHandled == inputsPushed;
+    }
     };
-int main() {
+int main(int argc, char** argv) {
+    // By default a frame is only drawn when something on it changed;
+    // --continuous draws every frame as before
+    bool continuous = false;
+    const char* tracePath = "pyramid_trace.bin";
+    srand((unsigned int)time(nullptr));
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--continuous") == 0)
+            continuous = true;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (strcmp(argv[i], "--no-trace") == 0)
+            tracePath = nullptr;
+#ifdef TRACK_ALLOCATIONS
+        else if (strcmp(argv[i], "--check-allocations") == 0) {
+            const int games = 50;
+            PyramidSolitaire headless(true);
+            long long allocations = headless.checkSteadyStateAllocations(games);
+            cout << "steady state: " << allocations << " heap allocations over " << games << " games" << endl;
+            return allocations > 0 ? 1 : 0;
+        }
+#endif
+    }
+
     const int screenWidth = 1200;
     const int screenHeight = 800;
     InitWindow(screenWidth, screenHeight, "Pyramid Solitaire Game");
     SetTargetFPS(60);
 
     PyramidSolitaire game;
+    if (tracePath && !game.startTrace(tracePath))
+        cout << "could not open trace file " << tracePath << endl;
+    game.startSimulation();
+
+#ifdef TRACK_ALLOCATIONS
+    long long frame = 0;
+#endif
+
+    while (!WindowShouldClose() && !game.isExitRequested()) {
+        game.pollInput();
+
+        if (!continuous && !game.needsRedraw()) {
+            // Nothing to draw: leave the last frame up. With no clock running,
+            // block until the window gets an event; otherwise the clock can
+            // change the screen with none, so check again after a frame.
+            if (game.waitingForInput()) {
+                EnableEventWaiting();
+                PollInputEvents();
+                DisableEventWaiting();
+            }
+            else {
+                this_thread::sleep_for(chrono::milliseconds(1000 / 60));
+                PollInputEvents();
+            }
+            continue;
+        }
 
-    while (!WindowShouldClose()) {
-        game.update(GetFrameTime());
+#ifdef TRACK_ALLOCATIONS
+        long long frameStart = allocationCount;
+#endif
         game.render();
+#ifdef TRACK_ALLOCATIONS
+        long long frameAllocations = allocationCount - frameStart;
+        if (frameAllocations > 0) {
+            cout << "frame " << frame << ": " << frameAllocations << " heap allocations" << endl;
+        }
+        frame++;
+#endif
     }
 
+    game.stopSimulation();
     CloseWindow();
     return 0;
 }